@@ -12,62 +12,77 @@
 #include "ompl/util/Exception.h"
 
 #include <constraint_planner/kinematics/KinematicChain.h>
+#include <constraint_planner/base/jy_SampleProducer.h>
 #include <ompl/base/ConstrainedSpaceInformation.h>
+
+#include <array>
+#include <atomic>
+#include <vector>
 namespace ob = ompl::base;
+
+/* checks a uniform sample goes through before the valid state sampler returns it */
+enum SAMPLER_STAGE
+{
+    BOUNDS_STAGE,     // joint limits
+    CONSTRAINT_STAGE, // closed chain residual, answered from the sampler's own projection when it has not moved
+    COLLISION_STAGE,  // si->isValid()
+    SAMPLER_STAGES
+};
+
+/* counters of one stage, over the samples that reached it */
+struct SamplerStageStats
+{
+    unsigned long tested;
+    unsigned long passed;
+    double acceptance; // passed / tested
+    double time;       // mean seconds per test
+};
+
+/* Rejection cascade : a uniform sample is tested stage by stage and dropped at the first failure, up to attempts_
+   samples per sample() call. Each stage counts its tests, passes and time, and every reorder interval the stages are
+   sorted by measured time / rejection rate, the order that minimizes the expected cost per sample when the stages
+   are independent. A fixed order from setStageOrder() turns that off. */
 class jy_ConstrainedValidStateSampler : public ob::ConstrainedValidStateSampler
 {
 public:
-    jy_ConstrainedValidStateSampler(const ob::SpaceInformation *si) : ob::ConstrainedValidStateSampler(si), 
-                                                                    sampler_(si->getStateSpace()->allocStateSampler()),
-                                                                    constraint_(si->getStateSpace()->as<ompl::base::ConstrainedStateSpace>()->getConstraint())
-    // : ValidStateSampler(si), sampler_(si->getStateSpace()->allocStateSampler()), constraint_(si->getStateSpace()->as<ompl::base::ConstrainedStateSpace>()->getConstraint())
-    {
-        std::cout << "setting to default sampler" << std::endl;
-        lower_limit << -2.8973, -1.7628, -2.8973, -3.0718, -2.8973, -0.0175, -2.8973, -2.8973, -1.7628, -2.8973, -3.0718, -2.8973, -0.0175, -2.8973;
-        upper_limit << 2.8973, 1.7628, 2.8973, -0.0698, 2.8973, 3.7525, 2.8973, 2.8973, 1.7628, 2.8973, -0.0698, 2.8973, 3.7525, 2.8973;
-    }
+    /* producer : states popped from it are already checked, sample() only falls back to the cascade on an empty ring */
+    jy_ConstrainedValidStateSampler(const ob::SpaceInformation *si, jy_SampleProducerPtr producer = nullptr);
 
-    bool sample(ob::State *state) override
-    {
-        unsigned int tries = 0;
-        bool valid;
-        do
-        {
-            sampler_->sampleUniform(state);
-            // bool testbounds = testBounds(state);
-            // bool validity = si_->isValid(state);
-            // bool constraint = constraint_->isSatisfied(state);
-            // si_->printState(state);
-            // std::cout << testbounds << " " << validity << " " << constraint << std::endl;
-            
-        }
-        while ( !(valid = testBounds(state) && constraint_->isSatisfied(state) && si_->isValid(state) ) && ++tries < 50);
-        // if (valid)
-        // {
-            // OMPL_INFORM("ADD VALID STATE");
-            // return true;
-        // }
-        // else
-            // OMPL_WARN("INVALID STATE");
-        std::cout << valid << std::endl;
-        return valid; 
-    }
-
-    bool testBounds(ob::State *state) const
-    {
-        auto &&rstate = state->as<ob::ConstrainedStateSpace::StateType>()->getState()->as<KinematicChainSpace::StateType>();
-        for (unsigned int i = 0; i < 14; ++i)
-        {
-            if (rstate->values[i] > upper_limit[i] || rstate->values[i] < lower_limit[i])
-                return false;
-        }
-        return true;
-    }
+    bool sample(ob::State *state) override;
+
+    bool testBounds(ob::State *state) const;
+
+    /* tests in this order from now on and stops reordering, every stage must appear once */
+    void setStageOrder(const std::vector<SAMPLER_STAGE> &order);
+    const std::vector<SAMPLER_STAGE> &getStageOrder() const { return order_; }
+
+    /* samples between two reorderings by measured cost, 0 keeps the current order */
+    void setReorderInterval(unsigned int interval) { reorder_interval_ = interval; }
+    unsigned int getReorderInterval() const { return reorder_interval_; }
+
+    SamplerStageStats getStageStats(SAMPLER_STAGE stage) const;
+    void resetStageStats();
+
+    static const char *getStageName(SAMPLER_STAGE stage);
 
 private:
+    bool runStage(SAMPLER_STAGE stage, ob::State *state);
+    void reorderStages();
+
+    struct StageCounters
+    {
+        std::atomic<unsigned long> tested{0}, passed{0}, nanoseconds{0};
+    };
+
     ob::StateSamplerPtr sampler_;
     const ob::ConstraintPtr constraint_;
+    jy_SampleProducerPtr producer_;
     Eigen::Matrix<double, 14, 1> lower_limit, upper_limit;
+
+    std::vector<SAMPLER_STAGE> order_{BOUNDS_STAGE, CONSTRAINT_STAGE, COLLISION_STAGE};
+    unsigned int reorder_interval_{256};
+    unsigned long samples_{0};
+    std::array<StageCounters, SAMPLER_STAGES> counters_;
 };
 
 typedef std::shared_ptr<jy_ConstrainedValidStateSampler> jy_ConstrainedValidStateSamplerPtr;
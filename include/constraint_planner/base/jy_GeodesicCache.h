@@ -0,0 +1,83 @@
+#pragma once
+
+#include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
+
+#include <cstddef>
+#include <list>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+namespace ob = ompl::base;
+
+struct GeodesicCacheStats
+{
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long evictions;
+    std::size_t entries;
+    double hit_rate; ///< hits / lookups
+};
+
+/* Bounded LRU memo of discreteGeodesic() between two states, keyed by the coordinates of the two states in that
+   order, so the copies a PathGeometric makes of the roadmap states still hit. An entry keeps copies of both states
+   and only answers for exactly equal ones. It remembers whether the collision checked walk was valid,
+   whether the unchecked one reached the goal (a valid walk implies it, an unchecked one that stops implies an
+   invalid one), and optionally the states of a complete walk, which serve both modes. Collision results are only
+   valid as long as the scene is the same, clear() when it changes. Thread safe. */
+class jy_GeodesicCache
+{
+public:
+    jy_GeodesicCache(const ob::ConstrainedStateSpace *space, std::size_t capacity = 10000);
+    ~jy_GeodesicCache();
+
+    /* max entries, 0 disables the cache */
+    void setCapacity(std::size_t capacity);
+    std::size_t getCapacity() const { return capacity_; }
+
+    /* keep the states of complete walks, or only their results */
+    void setStoreGeodesics(bool store) { store_geodesics_ = store; }
+    bool getStoreGeodesics() const { return store_geodesics_; }
+
+    /* true when the entry answers this call : result is what discreteGeodesic() would return, and geodesic (when
+       asked) gets fresh copies of the stored states */
+    bool lookup(const ob::State *from, const ob::State *to, bool interpolate, std::vector<ob::State *> *geodesic,
+                bool &result);
+
+    /* records a discreteGeodesic() result. owned : states of the walk the cache takes over (a complete walk it
+       keeps, others it frees), copied : states of the walk that stay the caller's */
+    void insert(const ob::State *from, const ob::State *to, bool interpolate, bool result,
+                std::vector<ob::State *> *owned, const std::vector<ob::State *> *copied);
+
+    void clear();
+    GeodesicCacheStats getStats() const;
+    void resetStats();
+
+private:
+    struct Entry
+    {
+        std::size_t key;
+        ob::State *from, *to;
+        int valid{-1};   // collision checked walk : -1 unknown, 0 stopped, 1 reached
+        int reached{-1}; // unchecked walk
+        std::vector<ob::State *> states;
+    };
+
+    std::size_t key(const ob::State *from, const ob::State *to) const;
+    bool equal(const ob::State *a, const ob::State *b) const;
+
+    /* entry of exactly from -> to, nullptr otherwise. Caller holds the lock */
+    Entry *find(std::size_t key, const ob::State *from, const ob::State *to);
+    void erase(std::list<Entry>::iterator entry);
+    void freeStates(std::vector<ob::State *> &states) const;
+
+    const ob::ConstrainedStateSpace *space_;
+    std::size_t capacity_;
+    bool store_geodesics_{true};
+
+    std::list<Entry> entries_; // most recently used first
+    std::unordered_map<std::size_t, std::list<Entry>::iterator> index_;
+    mutable std::mutex mutex_;
+
+    unsigned long lookups_{0}, hits_{0}, evictions_{0};
+};
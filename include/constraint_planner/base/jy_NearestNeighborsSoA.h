@@ -0,0 +1,324 @@
+#pragma once
+
+#include <ompl/base/SpaceInformation.h>
+#include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
+#include <ompl/datastructures/NearestNeighbors.h>
+#include <ompl/util/Exception.h>
+
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <limits>
+#include <memory>
+#include <queue>
+#include <utility>
+#include <vector>
+
+namespace ob = ompl::base;
+
+namespace jy_soa
+{
+    enum
+    {
+        Dim = 14,  // KinematicChainSpace of the two arms
+        Lanes = 4  // doubles per AVX2 register
+    };
+
+    /* squared euclidean distances from q to the blocks * Lanes points of a block of Dim x Lanes coordinates each,
+       AVX2 + FMA when the cpu has them (checked once at run time), scalar loops otherwise */
+    void squaredDistances(const double *coordinates, std::size_t blocks, const double *q, double *out);
+
+    /* data of a state of a constrained space */
+    inline const double *stateCoordinates(const ob::State *state)
+    {
+        return state->as<ob::ConstrainedStateSpace::StateType>()->data();
+    }
+
+    /* the planners' state spaces jy_NearestNeighborsSoA can index */
+    inline bool supports(const ob::SpaceInformationPtr &si)
+    {
+        auto &&css = std::dynamic_pointer_cast<ob::ConstrainedStateSpace>(si->getStateSpace());
+        return css && css->getAmbientDimension() == Dim;
+    }
+}
+
+/* Nearest neighbors of the 14-D constrained states. Points are kept in a kd-tree whose leaves hold up to LeafSize
+   points in structure of arrays blocks of Lanes points (all x0, all x1, ...), a leaf is scanned by the vectorized
+   kernel, so below LeafSize points it is a plain brute force search. A leaf that outgrows LeafSize splits at the
+   median of its widest coordinate, one that cannot (all its points are the same) waits until it has doubled before
+   it tries again. Distances are euclidean over the 14 coordinates, the distance of
+   ConstrainedStateSpace and KinematicChainSpace, the distance function is not called. The planners give it the
+   coordinates of their elements with setCoordinateFunction() in setup(). */
+template <typename _T>
+class jy_NearestNeighborsSoA : public ompl::NearestNeighbors<_T>
+{
+public:
+    enum
+    {
+        LeafSize = 64
+    };
+
+    typedef std::function<const double *(const _T &)> CoordinateFunction;
+
+    void setCoordinateFunction(CoordinateFunction coordinates)
+    {
+        coordinates_ = std::move(coordinates);
+    }
+
+    void clear() override
+    {
+        root_.reset(new Node);
+        size_ = 0;
+    }
+
+    bool reportsSortedResults() const override
+    {
+        return true;
+    }
+
+    void add(const _T &data) override
+    {
+        const double *x = coordinates(data);
+        Node *node = root_.get();
+        while (!node->isLeaf())
+            node = x[node->dim] < node->split ? node->left.get() : node->right.get();
+        node->push(data, x);
+        size_++;
+        if (node->items.size() > node->capacity)
+            split(node);
+    }
+
+    void add(const std::vector<_T> &data) override
+    {
+        for (const _T &d : data)
+            add(d);
+    }
+
+    bool remove(const _T &data) override
+    {
+        const double *x = coordinates(data);
+        Node *node = root_.get();
+        while (!node->isLeaf())
+            node = x[node->dim] < node->split ? node->left.get() : node->right.get();
+
+        for (std::size_t i = 0; i < node->items.size(); i++)
+        {
+            if (node->items[i] == data)
+            {
+                node->erase(i);
+                size_--;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    _T nearest(const _T &data) const override
+    {
+        if (size_ == 0)
+            throw ompl::Exception("No elements found in nearest neighbors data structure");
+        Heap heap;
+        search(root_.get(), coordinates(data), 1, std::numeric_limits<double>::infinity(), heap);
+        return *heap.top().second;
+    }
+
+    void nearestK(const _T &data, std::size_t k, std::vector<_T> &nbh) const override
+    {
+        nbh.clear();
+        if (k == 0 || size_ == 0)
+            return;
+        Heap heap;
+        search(root_.get(), coordinates(data), k, std::numeric_limits<double>::infinity(), heap);
+        sorted(heap, nbh);
+    }
+
+    void nearestR(const _T &data, double radius, std::vector<_T> &nbh) const override
+    {
+        nbh.clear();
+        if (size_ == 0)
+            return;
+        Heap heap;
+        search(root_.get(), coordinates(data), std::numeric_limits<std::size_t>::max(), radius * radius, heap);
+        sorted(heap, nbh);
+    }
+
+    std::size_t size() const override
+    {
+        return size_;
+    }
+
+    void list(std::vector<_T> &data) const override
+    {
+        data.clear();
+        data.reserve(size_);
+        list(root_.get(), data);
+    }
+
+private:
+    /* max-heap of (squared distance, element) */
+    typedef std::pair<double, const _T *> Candidate;
+    typedef std::priority_queue<Candidate> Heap;
+
+    struct Node
+    {
+        bool isLeaf() const
+        {
+            return !left;
+        }
+
+        /* coordinate d of point i : block i / Lanes, row d, lane i % Lanes */
+        double &at(std::size_t i, unsigned int d)
+        {
+            return coordinates[(i / jy_soa::Lanes * jy_soa::Dim + d) * jy_soa::Lanes + i % jy_soa::Lanes];
+        }
+
+        void push(const _T &data, const double *x)
+        {
+            // a new block is padded with infinite coordinates, those lanes are never the nearest
+            if (items.size() % jy_soa::Lanes == 0)
+                coordinates.resize(coordinates.size() + jy_soa::Dim * jy_soa::Lanes, std::numeric_limits<double>::infinity());
+            for (unsigned int d = 0; d < jy_soa::Dim; d++)
+                at(items.size(), d) = x[d];
+            items.push_back(data);
+        }
+
+        /* the last point takes the place of point i */
+        void erase(std::size_t i)
+        {
+            const std::size_t last = items.size() - 1;
+            for (unsigned int d = 0; d < jy_soa::Dim; d++)
+            {
+                at(i, d) = at(last, d);
+                at(last, d) = std::numeric_limits<double>::infinity();
+            }
+            items[i] = items[last];
+            items.pop_back();
+            if (items.size() % jy_soa::Lanes == 0)
+                coordinates.resize(coordinates.size() - jy_soa::Dim * jy_soa::Lanes);
+        }
+
+        unsigned int dim{0};
+        double split{0};
+        std::size_t capacity{LeafSize}; ///< points the leaf holds before split() is tried
+        std::unique_ptr<Node> left, right;
+
+        std::vector<_T> items;
+        std::vector<double> coordinates;
+    };
+
+    const double *coordinates(const _T &data) const
+    {
+        if (!coordinates_)
+            throw ompl::Exception("jy_NearestNeighborsSoA: no coordinate function, the planner does not support it");
+        return coordinates_(data);
+    }
+
+    void split(Node *node)
+    {
+        const std::size_t n = node->items.size();
+        std::vector<double> lower(jy_soa::Dim, std::numeric_limits<double>::infinity());
+        std::vector<double> upper(jy_soa::Dim, -std::numeric_limits<double>::infinity());
+        for (std::size_t i = 0; i < n; i++)
+        {
+            for (unsigned int d = 0; d < jy_soa::Dim; d++)
+            {
+                lower[d] = std::min(lower[d], node->at(i, d));
+                upper[d] = std::max(upper[d], node->at(i, d));
+            }
+        }
+
+        unsigned int dim = 0;
+        for (unsigned int d = 1; d < jy_soa::Dim; d++)
+            if (upper[d] - lower[d] > upper[dim] - lower[dim])
+                dim = d;
+        if (!(upper[dim] > lower[dim]))
+        {
+            // identical points, the leaf stays oversized and add() stays amortized O(1)
+            node->capacity = 2 * n;
+            return;
+        }
+
+        std::vector<double> values(n);
+        for (std::size_t i = 0; i < n; i++)
+            values[i] = node->at(i, dim);
+        std::nth_element(values.begin(), values.begin() + n / 2, values.end());
+        double split = values[n / 2];
+        if (!(split > lower[dim]))
+            split = 0.5 * (lower[dim] + upper[dim]); // the lower half would be empty
+
+        node->dim = dim;
+        node->split = split;
+        node->left.reset(new Node);
+        node->right.reset(new Node);
+        double x[jy_soa::Dim];
+        for (std::size_t i = 0; i < n; i++)
+        {
+            for (unsigned int d = 0; d < jy_soa::Dim; d++)
+                x[d] = node->at(i, d);
+            (x[dim] < split ? node->left : node->right)->push(node->items[i], x);
+        }
+        node->items.clear();
+        node->items.shrink_to_fit();
+        node->coordinates.clear();
+        node->coordinates.shrink_to_fit();
+    }
+
+    /* the k nearest points within squared distance bound, into the heap */
+    void search(const Node *node, const double *q, std::size_t k, double bound, Heap &heap) const
+    {
+        if (node->isLeaf())
+        {
+            thread_local std::vector<double> distances;
+            const std::size_t n = node->items.size();
+            distances.resize(node->coordinates.size() / jy_soa::Dim);
+            jy_soa::squaredDistances(node->coordinates.data(), distances.size() / jy_soa::Lanes, q, distances.data());
+            for (std::size_t i = 0; i < n; i++)
+            {
+                const double d = distances[i];
+                if (d > bound)
+                    continue;
+                if (heap.size() < k)
+                    heap.emplace(d, &node->items[i]);
+                else if (d < heap.top().first)
+                {
+                    heap.pop();
+                    heap.emplace(d, &node->items[i]);
+                }
+            }
+            return;
+        }
+
+        const double diff = q[node->dim] - node->split;
+        const Node *near = diff < 0 ? node->left.get() : node->right.get();
+        const Node *far = diff < 0 ? node->right.get() : node->left.get();
+        search(near, q, k, bound, heap);
+        const double worst = heap.size() < k ? bound : std::min(bound, heap.top().first);
+        if (diff * diff <= worst)
+            search(far, q, k, bound, heap);
+    }
+
+    static void sorted(Heap &heap, std::vector<_T> &nbh)
+    {
+        nbh.resize(heap.size());
+        for (std::size_t i = nbh.size(); i > 0; i--)
+        {
+            nbh[i - 1] = *heap.top().second;
+            heap.pop();
+        }
+    }
+
+    static void list(const Node *node, std::vector<_T> &data)
+    {
+        if (node->isLeaf())
+            data.insert(data.end(), node->items.begin(), node->items.end());
+        else
+        {
+            list(node->left.get(), data);
+            list(node->right.get(), data);
+        }
+    }
+
+    CoordinateFunction coordinates_;
+    std::unique_ptr<Node> root_{new Node};
+    std::size_t size_{0};
+};
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <constraint_planner/base/jy_ProjectedStateSpace.h>
+#include <constraint_planner/kinematics/panda_analytic_ik.h>
+
+#include <Eigen/Geometry>
+#include <vector>
+
+/* Samples the grasped object instead of the joints : an object pose in the workspace box, a random closed-form IK
+   solution of each arm through its grasp (panda_ik::solveAll over a q7 sweep), then project() polishes what the
+   grasp frames leave of the residual. Starting on the manifold the projection has next to nothing to do, where a
+   uniform 14 dof sample is a Newton solve from far away that often fails. The closed form fails fast on unreachable
+   poses, TRAC-IK would spend its whole timeout on them. After `attempts` object poses without an IK pair it falls
+   back to the projected uniform sample. Near and gaussian samples stay projected ones. */
+class jy_ObjectStateSampler : public jy_ProjectedStateSampler
+{
+public:
+    /* base_* : arm bases in the world, obj_*grasp : object -> end-effector of each arm */
+    jy_ObjectStateSampler(const jy_ProjectedStateSpace *space, ob::StateSamplerPtr sampler,
+                          const Eigen::Affine3d &base_serve, const Eigen::Affine3d &base_main,
+                          const Eigen::Affine3d &obj_Sgrasp, const Eigen::Affine3d &obj_Mgrasp);
+
+    void sampleUniform(ob::State *state) override;
+
+    /* object position box in the world frame */
+    void setWorkspace(const Eigen::Vector3d &low, const Eigen::Vector3d &high);
+    /* object orientation within max_angle (rad) of nominal, M_PI allows every orientation */
+    void setOrientation(const Eigen::Quaterniond &nominal, double max_angle);
+    void setAttempts(unsigned int attempts) { attempts_ = attempts; }
+    /* q7 values each arm's closed-form IK is swept over */
+    void setIKSteps(unsigned int steps) { ik_steps_ = steps; }
+
+    unsigned long getSampleCount() const { return samples_; }
+    /* samples that came from the projected uniform sampler because no object pose gave an IK pair */
+    unsigned long getFallbackCount() const { return fallbacks_; }
+
+private:
+    Eigen::Affine3d sampleObjectPose();
+
+    Eigen::Affine3d base_serve_inv_, base_main_inv_, obj_Sgrasp_, obj_Mgrasp_;
+    Eigen::Vector3d low_, high_;
+    Eigen::Quaterniond nominal_;
+    double max_angle_{M_PI};
+    unsigned int attempts_{10};
+    unsigned int ik_steps_{8};
+    std::vector<Vector7d> serve_solutions_, main_solutions_;
+
+    unsigned long samples_{0}, fallbacks_{0};
+};
@@ -8,12 +8,34 @@
 
 #include <ompl/base/spaces/RealVectorStateSpace.h>
 #include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
+#include <constraint_planner/base/jy_GeodesicCache.h>
+#include <constraint_planner/constraints/ClosedChainConstraint.h>
 
 #include <Eigen/Core>
+#include <atomic>
 #include <utility>
 namespace ob = ompl::base;
+
+/* how discreteGeodesic walks from one state to the other */
+enum GEODESIC_TYPE
+{
+    INTERPOLATE_PROJECT, // ambient straight line by delta, every step projected from scratch (OMPL's ProjectedStateSpace)
+    PREDICTOR_CORRECTOR  // step along the tangent space, then a capped number of Newton corrections
+};
+
+/* counters of the predictor-corrector walk, summed over every discreteGeodesic call */
+struct GeodesicStats
+{
+    unsigned long calls;
+    unsigned long steps;       ///< accepted steps
+    unsigned long corrections; ///< corrector iterations over all predictions, rejected ones included
+    unsigned long rejections;  ///< predictions retried with a halved step
+    unsigned long fallbacks;   ///< predictions the corrector gave up on and project() finished
+};
+
 class jy_ProjectedStateSpace;
 typedef std::shared_ptr<jy_ProjectedStateSpace> jy_ProjectedStateSpacePtr;
+class jy_SampleProducer;
 
 class jy_ProjectedStateSampler : public ob::WrapperStateSampler
 {
@@ -21,22 +43,41 @@ public:
     jy_ProjectedStateSampler(const jy_ProjectedStateSpace *space, ob::StateSamplerPtr sampler) ;
 
     void sampleUniform(ob::State *state) override;
+    /* Near and gaussian samples are drawn in the tangent space at near / mean (the nullspace of the jacobian) and
+       projected from there. Nothing of the perturbation is spent in normal directions the projection undoes, and the
+       projection starts O(kappa d^2) off the manifold instead of O(d), one or two iterations. */
     void sampleUniformNear(ob::State *state, const ob::State *near, double distance) override;
     void sampleGaussian(ob::State *state, const ob::State *mean, double stdDev) override;
 
+    /* uniform samples are popped from the producer's ring while it has states */
+    void setProducer(std::shared_ptr<jy_SampleProducer> producer) { producer_ = std::move(producer); }
+
 protected:
+    bool popProduced(ob::State *state);
+
+    /* orthonormal basis of the tangent space at state in tangent_, kept while the same state is asked again */
+    void tangentBasis(const ob::State *state);
+
     const ob::ConstraintPtr constraint_;
+    std::shared_ptr<jy_SampleProducer> producer_;
+
+    Eigen::MatrixXd jacobian_, tangent_;
+    Eigen::VectorXd tangent_at_, step_;
 };
 
 class jy_ProjectedStateSpace : public ob::ConstrainedStateSpace
 {
 public:            
     jy_ProjectedStateSpace(const ob::StateSpacePtr &ambientSpace, const ob::ConstraintPtr &constraint)
-    : ob::ConstrainedStateSpace(ambientSpace, constraint)
+    : ob::ConstrainedStateSpace(ambientSpace, constraint), cache_(this),
+      chain_(dynamic_cast<const ChainConstraint *>(constraint.get()))
     {
         setName("Projected" + space_->getName());
     }
-    ~jy_ProjectedStateSpace() override = default;
+    ~jy_ProjectedStateSpace() override
+    {
+        cache_.clear();
+    }
 
     ob::StateSamplerPtr allocDefaultStateSampler() const override
     {
@@ -46,9 +87,61 @@ public:
             /**  Allocate the previously set state sampler for this space. */
     ob::StateSamplerPtr allocStateSampler() const override
     {
+        if (ssa_)
+            return ssa_(this);
         return std::make_shared<jy_ProjectedStateSampler>(this, space_->allocStateSampler());
     }
 
+    /* answered from the geodesic cache when it knows this pair of states, interpolate() then reuses the walks
+       checkMotion() made */
     bool discreteGeodesic(const ob::State *from, const ob::State *to, bool interpolate = false,
                                   std::vector<ob::State *> *geodesic = nullptr) const override;
+
+    /* memo of discreteGeodesic() between the same two states, clear it when the scene changes */
+    jy_GeodesicCache &getGeodesicCache() const { return cache_; }
+
+    void setGeodesicType(GEODESIC_TYPE type) { geodesic_type_ = type; }
+    GEODESIC_TYPE getGeodesicType() const { return geodesic_type_; }
+
+    /* Newton iterations the predictor-corrector spends on a step before it halves it */
+    void setCorrectorIterations(unsigned int iterations) { corrector_iterations_ = iterations; }
+    unsigned int getCorrectorIterations() const { return corrector_iterations_; }
+
+    GeodesicStats getGeodesicStats() const
+    {
+        return {geodesic_calls_, geodesic_steps_, geodesic_corrections_, geodesic_rejections_, geodesic_fallbacks_};
+    }
+    void resetGeodesicStats()
+    {
+        geodesic_calls_ = geodesic_steps_ = geodesic_corrections_ = geodesic_rejections_ = geodesic_fallbacks_ = 0;
+    }
+
+private:
+    /* discreteGeodesic() without the cache */
+    bool walkGeodesic(const ob::State *from, const ob::State *to, bool interpolate,
+                      std::vector<ob::State *> *geodesic) const;
+
+    /* OMPL's ProjectedStateSpace walk : ambient straight line by delta, every step projected */
+    bool interpolateProjectGeodesic(const ob::State *from, const ob::State *to, bool interpolate,
+                                    std::vector<ob::State *> *geodesic) const;
+
+    /* The step h starts at delta and never exceeds it, so motions are still checked at the delta resolution.
+       Each prediction moves min(h, dist) along the goal direction projected onto the nullspace of the jacobian,
+       the correction then pulls it back with minimum norm Newton steps. The correction length gives the
+       curvature (|c| ~ kappa h^2 / 2) and the next h is the one that keeps |c| about a tenth of the step. */
+    bool predictorCorrectorGeodesic(const ob::State *from, const ob::State *to, bool interpolate,
+                                    std::vector<ob::State *> *geodesic) const;
+
+    /* residual and jacobian at x, from a single kinematics pass when the constraint is a ChainConstraint */
+    void evaluate(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::VectorXd &f, Eigen::MatrixXd &j) const;
+    /* isSatisfied() of the state whose residual evaluate() returned */
+    bool isSatisfied(const Eigen::VectorXd &f) const;
+
+    GEODESIC_TYPE geodesic_type_{INTERPOLATE_PROJECT};
+    unsigned int corrector_iterations_{2};
+    mutable jy_GeodesicCache cache_;
+    const ChainConstraint *chain_; ///< the constraint as a ChainConstraint, null for other constraints
+
+    mutable std::atomic<unsigned long> geodesic_calls_{0}, geodesic_steps_{0}, geodesic_corrections_{0},
+        geodesic_rejections_{0}, geodesic_fallbacks_{0};
 };
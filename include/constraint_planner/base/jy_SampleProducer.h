@@ -0,0 +1,121 @@
+#pragma once
+
+#include <ompl/base/SpaceInformation.h>
+#include <ompl/base/StateSampler.h>
+
+#include <atomic>
+#include <chrono>
+#include <functional>
+#include <memory>
+#include <thread>
+#include <vector>
+
+namespace ob = ompl::base;
+
+/* Bounded multi-producer multi-consumer ring of fixed length double vectors, with a sequence number per cell
+   (D. Vyukov's bounded MPMC queue). push() and pop() never block, they fail on a full / empty ring. */
+class jy_SampleRing
+{
+public:
+    /* capacity is rounded up to a power of two */
+    jy_SampleRing(std::size_t capacity, unsigned int dimension);
+
+    bool push(const double *values);
+    bool pop(double *values);
+
+    /* approximate while producers and consumers run */
+    std::size_t size() const;
+    std::size_t capacity() const { return mask_ + 1; }
+
+private:
+    struct Cell
+    {
+        std::atomic<std::size_t> sequence;
+    };
+
+    std::size_t mask_;
+    unsigned int dimension_;
+    std::unique_ptr<Cell[]> cells_;
+    std::vector<double> values_;
+
+    alignas(64) std::atomic<std::size_t> enqueue_pos_{0};
+    alignas(64) std::atomic<std::size_t> dequeue_pos_{0};
+};
+
+struct SampleProducerStats
+{
+    std::size_t depth;      ///< states waiting in the ring
+    std::size_t capacity;
+    unsigned long produced; ///< states that passed bounds, constraint and collision checks
+    unsigned long rejected; ///< samples the workers threw away
+    unsigned long consumed;
+    unsigned long starved;  ///< pops that found the ring empty and sampled inline instead
+    double rate;            ///< produced states per second between start() and stop() or now
+};
+
+/* Background valid-sample service : `threads` workers sample with their own state sampler, keep the states that
+   are inside the bounds, on the manifold and collision free, and push them into a jy_SampleRing. Planners pop
+   through jy_ProjectedStateSampler and jy_ConstrainedValidStateSampler, which sample inline when the ring is
+   empty. Workers idle while the ring is full. */
+class jy_SampleProducer
+{
+public:
+    /* called once per worker thread, the samplers must not pop from this producer themselves */
+    typedef std::function<ob::StateSamplerPtr()> SamplerAllocator;
+
+    jy_SampleProducer(ob::SpaceInformationPtr si, SamplerAllocator allocator, unsigned int threads, std::size_t capacity);
+    ~jy_SampleProducer();
+
+    void start();
+    void stop();
+    bool isRunning() const { return running_; }
+
+    /* copies the next produced state into state, false when none is waiting */
+    bool pop(ob::State *state);
+
+    SampleProducerStats getStats() const;
+    void resetStats();
+
+private:
+    void produce();
+
+    ob::SpaceInformationPtr si_;
+    SamplerAllocator allocator_;
+    unsigned int threads_;
+    jy_SampleRing ring_;
+
+    std::vector<std::thread> workers_;
+    std::atomic<bool> running_{false};
+    std::chrono::steady_clock::time_point start_time_, stop_time_;
+
+    std::atomic<unsigned long> produced_{0}, rejected_{0}, consumed_{0}, starved_{0};
+};
+
+typedef std::shared_ptr<jy_SampleProducer> jy_SampleProducerPtr;
+
+/* Runs a producer for the lifetime of the scope : start() on construction, stop() on destruction, so the workers
+   are joined when a solve throws. A null producer is accepted and does nothing. */
+class jy_SampleProductionScope
+{
+public:
+    explicit jy_SampleProductionScope(jy_SampleProducerPtr producer) : producer_(std::move(producer))
+    {
+        if (producer_)
+            producer_->start();
+    }
+
+    ~jy_SampleProductionScope() { stop(); }
+
+    jy_SampleProductionScope(const jy_SampleProductionScope &) = delete;
+    jy_SampleProductionScope &operator=(const jy_SampleProductionScope &) = delete;
+
+    /* stops the workers before the scope ends, e.g. to read final stats */
+    void stop()
+    {
+        if (producer_)
+            producer_->stop();
+    }
+
+private:
+    jy_SampleProducerPtr producer_;
+};
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+
+struct ValidityCacheStats
+{
+    unsigned long lookups;
+    unsigned long hits;
+    unsigned long inserts;
+    std::size_t capacity;
+    double hit_rate; ///< hits / lookups
+};
+
+/* Validity results of joint vectors, keyed by the vector quantized to a resolution : every configuration in the same
+   cell of the grid shares one result, so the resolution trades exactness for hits, the default only merges vectors
+   that differ by rounding. A fixed table of capacity slots, each one a single atomic word holding the key's hash and
+   the result, so lookups and inserts take no lock, a new key takes the slot of whatever was there. invalidate()
+   starts a new generation that is part of every hash, the old entries never hit again and are overwritten. */
+class jy_ValidityCache
+{
+public:
+    /* capacity : slots, rounded up to a power of two (8 bytes each), 0 disables the cache */
+    jy_ValidityCache(unsigned int dimension, std::size_t capacity = 1 << 20, double resolution = 1e-6);
+
+    /* drops every result, not while queries run */
+    void setCapacity(std::size_t capacity);
+    std::size_t getCapacity() const { return capacity_; }
+
+    /* size of a grid cell, in radians */
+    void setResolution(double resolution);
+    double getResolution() const { return resolution_; }
+
+    /* true when the cell of q has a result */
+    bool lookup(const double *q, bool &valid) const;
+    void insert(const double *q, bool valid);
+
+    /* the scene changed, forget every result */
+    void invalidate();
+
+    ValidityCacheStats getStats() const;
+    void resetStats();
+
+private:
+    /* hash of the quantized q in this generation, never 0 (empty slots) and always even (the result bit) */
+    std::uint64_t key(const double *q) const;
+
+    unsigned int dimension_;
+    std::size_t capacity_{0};
+    double resolution_;
+    std::unique_ptr<std::atomic<std::uint64_t>[]> slots_;
+    std::atomic<std::uint64_t> generation_{0};
+
+    mutable std::atomic<unsigned long> lookups_{0}, hits_{0};
+    std::atomic<unsigned long> inserts_{0};
+};
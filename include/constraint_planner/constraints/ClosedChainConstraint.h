@@ -0,0 +1,494 @@
+#pragma once
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <limits>
+
+#include <Eigen/Dense>
+#include <ompl/base/Constraint.h>
+#include <ompl/util/Console.h>
+#include <ompl/util/Exception.h>
+
+/* how ChainConstraint::project() pulls a state onto the manifold */
+enum PROJECTION_TYPE
+{
+    NEWTON_PROJECTION, // fixed 0.20 damped Newton step through an SVD solve
+    LM_PROJECTION,     // Levenberg-Marquardt with adaptive damping on the CoDim x CoDim normal equations
+    BOUNDED_PROJECTION // LM in affine-scaled joint space, every iterate stays inside the joint limits
+};
+
+/* counters over all project() calls of one constraint */
+struct ProjectionStats
+{
+    unsigned long calls;
+    unsigned long successes;
+    unsigned long iterations;
+    unsigned long stalled;  // LM only : the residual stopped decreasing
+    unsigned long diverged; // LM only : no damping decreased the residual, or it was not finite
+};
+
+/* jacobian() and evaluate() calls of one constraint : the atlas builds its charts and projects on them through
+   them, the projection engines do not. Only counted while setRecordJacobians(true), the clock reads and the shared
+   counters are not free on the projection path */
+struct JacobianStats
+{
+    unsigned long calls;
+    double time; // seconds, summed over the threads
+};
+
+/* Size independent part of the closed chain constraints : tolerances, projection engine and statistics.
+   ConstrainedProblem only talks to this interface. */
+class ChainConstraint : public ompl::base::Constraint
+{
+public:
+    ChainConstraint(unsigned int ambientDim, unsigned int coDim) : ompl::base::Constraint(ambientDim, coDim)
+    {
+    }
+
+    /* tolerance1 : translation residual, tolerance2 : orientation residual */
+    void setTolerance(const double tolerance1, const double tolerance2)
+    {
+        if (tolerance1 <= 0 || tolerance2 <= 0)
+            throw ompl::Exception("ompl::base::Constraint::setProjectionTolerance(): "
+                                  "tolerance must be positive.");
+        tolerance1_ = tolerance1;
+        tolerance2_ = tolerance2;
+        OMPL_INFORM("Set tolerance to %f and %f", tolerance1_, tolerance2_);
+    }
+
+    void setProjectionType(PROJECTION_TYPE type) { projection_type_ = type; }
+    PROJECTION_TYPE getProjectionType() const { return projection_type_; }
+
+    ProjectionStats getProjectionStats() const
+    {
+        return {proj_calls_, proj_successes_, proj_iterations_, proj_stalled_, proj_diverged_};
+    }
+
+    void resetProjectionStats()
+    {
+        proj_calls_ = 0;
+        proj_successes_ = 0;
+        proj_iterations_ = 0;
+        proj_stalled_ = 0;
+        proj_diverged_ = 0;
+    }
+
+    JacobianStats getJacobianStats() const
+    {
+        return {jacobian_calls_, 1e-9 * jacobian_nanoseconds_};
+    }
+
+    void resetJacobianStats()
+    {
+        jacobian_calls_ = 0;
+        jacobian_nanoseconds_ = 0;
+    }
+
+    /* ConstrainedProblem turns this on for the atlas and tangent bundle spaces only, set it before planning */
+    void setRecordJacobians(bool record) { record_jacobians_ = record; }
+    bool getRecordJacobians() const { return record_jacobians_; }
+
+    /* iterations of the last project() call made on the calling thread */
+    static unsigned int getLastProjectionIterations() { return lastProjectionIterations(); }
+
+    /* function() and jacobian() at x from a single kinematics pass */
+    virtual void evaluate(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Ref<Eigen::VectorXd> f,
+                          Eigen::Ref<Eigen::MatrixXd> j) const = 0;
+
+    /* the test isSatisfied() makes, on a residual evaluate() or function() already returned */
+    bool isResidualSatisfied(const Eigen::Ref<const Eigen::VectorXd> &f) const
+    {
+        return f.allFinite() && f.head(3).squaredNorm() <= tolerance1_ * tolerance1_ &&
+               f.tail(f.size() - 3).squaredNorm() <= tolerance2_ * tolerance2_;
+    }
+
+protected:
+    void recordProjection(bool success, unsigned int iterations) const
+    {
+        lastProjectionIterations() = iterations;
+        proj_calls_++;
+        proj_iterations_ += iterations;
+        if (success)
+            proj_successes_++;
+    }
+
+    void recordJacobian(std::chrono::steady_clock::time_point begin) const
+    {
+        jacobian_calls_++;
+        jacobian_nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    static unsigned int &lastProjectionIterations()
+    {
+        thread_local unsigned int iterations = 0;
+        return iterations;
+    }
+
+    double tolerance1_, tolerance2_;
+    PROJECTION_TYPE projection_type_{NEWTON_PROJECTION};
+    bool record_jacobians_{false};
+    unsigned int maxIterations{100}; // Newton's own limit, LM and bounded projection use getMaxIterations()
+
+    mutable std::atomic<unsigned long> proj_stalled_{0}, proj_diverged_{0};
+
+private:
+    mutable std::atomic<unsigned long> proj_calls_{0}, proj_successes_{0}, proj_iterations_{0};
+    mutable std::atomic<unsigned long> jacobian_calls_{0}, jacobian_nanoseconds_{0};
+};
+
+/* Closed chain of Arms 7 dof arms with CoDim residuals : the first 3 are the translation error (tolerance1_),
+   the others the orientation error (tolerance2_). Everything from function() down to the projection loops
+   works on fixed-size Eigen types, so evaluating or projecting a state does not touch the heap. */
+template <int Arms, int CoDim>
+class ClosedChainConstraint : public ChainConstraint
+{
+public:
+    enum
+    {
+        Dim = 7 * Arms
+    };
+    typedef Eigen::Matrix<double, Dim, 1> StateVector;
+    typedef Eigen::Matrix<double, CoDim, 1> ResidualVector;
+    typedef Eigen::Matrix<double, CoDim, Dim> JacobianMatrix;
+    typedef Eigen::Matrix<double, CoDim, CoDim> NormalMatrix;
+
+    ClosedChainConstraint() : ChainConstraint(Dim, CoDim)
+    {
+        theta = 0.99995;
+        beta1 = 0.1;
+        beta2 = 0.2; // 0.25
+        trust_radius_min = 5*10e-4;
+    }
+
+    /* residual of the closed chain at x */
+    virtual void computeResidual(const StateVector &x, ResidualVector &f) const = 0;
+    /* residual and its jacobian from a single kinematics pass */
+    virtual void computeResidual(const StateVector &x, ResidualVector &f, JacobianMatrix &j) const = 0;
+
+    void function(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Ref<Eigen::VectorXd> out) const override
+    {
+        StateVector q = x;
+        ResidualVector f;
+        computeResidual(q, f);
+        out = f;
+    }
+
+    void jacobian(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Ref<Eigen::MatrixXd> out) const override
+    {
+        std::chrono::steady_clock::time_point begin;
+        if (record_jacobians_)
+            begin = std::chrono::steady_clock::now();
+        StateVector q = x;
+        ResidualVector f;
+        JacobianMatrix j;
+        computeResidual(q, f, j);
+        out = j;
+        if (record_jacobians_)
+            recordJacobian(begin);
+    }
+
+    void evaluate(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Ref<Eigen::VectorXd> f, Eigen::Ref<Eigen::MatrixXd> j) const override
+    {
+        std::chrono::steady_clock::time_point begin;
+        if (record_jacobians_)
+            begin = std::chrono::steady_clock::now();
+        StateVector q = x;
+        ResidualVector fq;
+        JacobianMatrix jq;
+        computeResidual(q, fq, jq);
+        f = fq;
+        j = jq;
+        if (record_jacobians_)
+            recordJacobian(begin);
+    }
+
+    /* a state project() just returned is answered from its last residual, without another kinematics pass */
+    bool isSatisfied(const Eigen::Ref<const Eigen::VectorXd> &x) const override
+    {
+        const LastProjection &last = lastProjection();
+        if (last.owner == this && x == last.q)
+            return last.f.allFinite() && withinTolerance(last.f);
+
+        StateVector q = x;
+        ResidualVector f;
+        computeResidual(q, f);
+        return f.allFinite() && withinTolerance(f);
+    }
+
+    bool project(Eigen::Ref<Eigen::VectorXd> x) const override
+    {
+        StateVector q = x;
+        unsigned int iter = 0;
+        bool success;
+        if (projection_type_ == LM_PROJECTION)
+            success = projectLM(q, iter);
+        else if (projection_type_ == BOUNDED_PROJECTION)
+            success = projectBounded(q, iter);
+        else
+            success = projectNewton(q, iter);
+        x = q;
+
+        recordProjection(success, iter);
+        return success;
+    }
+
+    bool projectNewton(StateVector &x, unsigned int &iter) const
+    {
+        // Newton's method
+        ResidualVector f;
+        JacobianMatrix j;
+
+        computeResidual(x, f, j);
+        while (!withinTolerance(f) && iter++ < maxIterations)
+        {
+            x -= 0.20 * j.jacobiSvd(Eigen::ComputeFullU | Eigen::ComputeFullV).solve(f);
+            computeResidual(x, f, j);
+        }
+        rememberProjection(x, f);
+        return withinTolerance(f);
+    }
+
+    /* Levenberg-Marquardt : the step is -J^T (J J^T + lambda I)^-1 f, so only a CoDim x CoDim system is factorized.
+       lambda shrinks after every step that lowers |f| and grows until one does. Stops early when the
+       decrease stalls or when no damping lowers |f| any more, instead of spending the iteration budget. */
+    bool projectLM(StateVector &x, unsigned int &iter) const
+    {
+        return projectDamped(x, iter, false);
+    }
+
+    /* projectLM() restricted to the joint limits, after Coleman and Li's affine scaling : with
+       D^-2 = scaling_matrix_inv()^2 = |distance to the limit the gradient J^T f points at|, the step is
+       -D^-2 J^T (J D^-2 J^T + lambda I)^-1 f, so joints close to that limit barely move, and alpha_p()
+       shortens it to stay strictly inside. Nothing converges outside the limits and gets clamped
+       off the manifold by enforceBounds() afterwards. */
+    bool projectBounded(StateVector &x, unsigned int &iter) const
+    {
+        const double interior = 1e-6; // start this far inside the limits, the scaling is singular on them
+        x = x.cwiseMax((lower_limit.array() + interior).matrix()).cwiseMin((upper_limit.array() - interior).matrix());
+        return projectDamped(x, iter, true);
+    }
+
+    Eigen::DiagonalMatrix<double, Dim> scaling_matrix(const StateVector &x) const
+    {
+        return scaling_matrix(x, new_jacobian(x));
+    }
+
+    Eigen::DiagonalMatrix<double, Dim> scaling_matrix(const StateVector &x, const StateVector &new_j) const
+    {
+        StateVector v;
+        for (int i = 0; i < Dim; i++)
+        {
+            if (new_j[i] < 0)
+                v[i] = x[i] - upper_limit[i];
+            else
+                v[i] = x[i] - lower_limit[i];
+        }
+        for (int i = 0; i < Dim; i++)
+            v[i] = std::pow(std::abs(v[i]), -0.5);
+        return v.asDiagonal();
+    }
+
+    Eigen::DiagonalMatrix<double, Dim> scaling_matrix_inv(const StateVector &x) const
+    {
+        return scaling_matrix_inv(x, new_jacobian(x));
+    }
+
+    Eigen::DiagonalMatrix<double, Dim> scaling_matrix_inv(const StateVector &x, const StateVector &new_j) const
+    {
+        StateVector v;
+        for (int i = 0; i < Dim; i++)
+        {
+            if (new_j[i] < 0)
+                v[i] = x[i] - upper_limit[i];
+            else
+                v[i] = x[i] - lower_limit[i];
+        }
+        for (int i = 0; i < Dim; i++)
+            v[i] = std::pow(std::abs(v[i]), 0.5);
+        return v.asDiagonal();
+    }
+
+    double new_function(const StateVector &x) const
+    {
+        ResidualVector f;
+        computeResidual(x, f);
+        return 0.5 * f.squaredNorm();
+    }
+
+    StateVector new_jacobian(const StateVector &x) const
+    {
+        ResidualVector f;
+        JacobianMatrix j;
+        computeResidual(x, f, j);
+        return j.transpose() * f;
+    }
+
+    double model_function(const StateVector &x, const StateVector &p) const
+    {
+        ResidualVector f;
+        JacobianMatrix j;
+        computeResidual(x, f, j);
+        return model_function(f, j, p);
+    }
+
+    /* quadratic model 0.5 * |f + J p|^2 from an already evaluated f and J */
+    double model_function(const ResidualVector &f, const JacobianMatrix &j, const StateVector &p) const
+    {
+        return 0.5 * (f + j * p).squaredNorm();
+    }
+
+    /* p shortened to stay strictly inside the joint limits when x + p would leave them */
+    StateVector alpha_p(const StateVector &x, const StateVector &p) const
+    {
+        StateVector result, t;
+        for (int i = 0; i < Dim; i++)
+        {
+            if ( p[i] > 0 )
+                t[i] = (upper_limit[i] - x[i]) / p[i];
+            else if ( p[i] < 0 )
+                t[i] = (lower_limit[i] - x[i]) / p[i];
+            else
+                t[i] = std::numeric_limits<double>::infinity();
+        }
+
+        double lambda = t.minCoeff();
+        if (lambda > 1)
+            result = p;
+        else
+            result = std::max(theta, 1 - p.norm()) * lambda * p;
+
+        return result;
+    }
+
+    double cauchy_ratio(const StateVector &x, const StateVector &p_cauchy, const StateVector &p_current) const
+    {
+        ResidualVector f;
+        JacobianMatrix j;
+        computeResidual(x, f, j);
+
+        double model_zero = model_function(f, j, StateVector::Zero());
+        double numerator  = model_zero - model_function(f, j, alpha_p(x, p_current));
+        double denominator = model_zero - model_function(f, j, alpha_p(x, p_cauchy));
+        return numerator / denominator;
+    }
+
+    double quad_solve(const Eigen::DiagonalMatrix<double, Dim> &D, const StateVector &p_cauchy, const StateVector &p_newton, double trust_radius) const
+    {
+        StateVector p_diff = p_newton - p_cauchy;
+        double a = (D * p_diff).squaredNorm();
+        double b = 2 * p_diff.dot(D * (D * (2 * p_cauchy - p_newton)));
+        double c = (D * (2 * p_cauchy - p_newton)).squaredNorm() - std::pow(trust_radius, 2);
+        double det = b * b - 4 * a * c;
+        if (det >= 0)
+            return (-b + std::sqrt(det)) / (2 * a);
+        else
+            return 0;
+    }
+
+protected:
+    bool withinTolerance(const ResidualVector &f) const
+    {
+        return f.template head<3>().squaredNorm() <= tolerance1_ * tolerance1_ &&
+               f.template tail<CoDim - 3>().squaredNorm() <= tolerance2_ * tolerance2_;
+    }
+
+    StateVector upper_limit, lower_limit;
+    double theta, beta1, beta2, trust_radius_min;
+
+private:
+    /* shared loop of projectLM() and projectBounded() */
+    bool projectDamped(StateVector &x, unsigned int &iter, bool bounded) const
+    {
+        const double lambda_min = 1e-9, lambda_max = 1e8;
+        const double stall_decrease = 1e-3; // relative decrease of |f|^2 that still counts as progress
+        const unsigned int max_stalls = 3;
+
+        StateVector x_new;
+        ResidualVector f, f_new;
+        JacobianMatrix j, j_new, jd;
+        Eigen::DiagonalMatrix<double, Dim> d2;
+        Eigen::LDLT<NormalMatrix> ldlt;
+        double lambda = 1e-2;
+        unsigned int stalls = 0;
+
+        computeResidual(x, f, j);
+        double cost = f.squaredNorm();
+        if (!std::isfinite(cost))
+        {
+            proj_diverged_++;
+            return false;
+        }
+
+        while (!withinTolerance(f) && iter < getMaxIterations())
+        {
+            iter++;
+            if (bounded)
+            {
+                d2 = scaling_matrix_inv(x, j.transpose() * f);
+                d2.diagonal() = d2.diagonal().cwiseAbs2();
+                jd = j * d2;
+                ldlt.compute(jd * j.transpose() + lambda * NormalMatrix::Identity());
+                x_new = x + alpha_p(x, -jd.transpose() * ldlt.solve(f));
+            }
+            else
+            {
+                ldlt.compute(j * j.transpose() + lambda * NormalMatrix::Identity());
+                x_new = x - j.transpose() * ldlt.solve(f);
+            }
+            computeResidual(x_new, f_new, j_new);
+
+            double cost_new = f_new.squaredNorm();
+            if (std::isfinite(cost_new) && cost_new < cost)
+            {
+                stalls = (cost - cost_new < stall_decrease * cost) ? stalls + 1 : 0;
+                x = x_new;
+                f = f_new;
+                j = j_new;
+                cost = cost_new;
+                lambda = std::max(lambda / 3, lambda_min);
+
+                if (stalls >= max_stalls && !withinTolerance(f))
+                {
+                    proj_stalled_++;
+                    break;
+                }
+            }
+            else
+            {
+                lambda *= 2;
+                if (lambda > lambda_max)
+                {
+                    proj_diverged_++;
+                    break;
+                }
+            }
+        }
+        rememberProjection(x, f);
+        return withinTolerance(f);
+    }
+
+    /* last iterate and residual of project() on the calling thread. isSatisfied() only trusts it for the exact
+       same joints, a state changed after the projection (enforceBounds(), interpolation) is evaluated again. */
+    struct LastProjection
+    {
+        const ClosedChainConstraint *owner{nullptr};
+        StateVector q;
+        ResidualVector f;
+    };
+
+    static LastProjection &lastProjection()
+    {
+        thread_local LastProjection last;
+        return last;
+    }
+
+    void rememberProjection(const StateVector &x, const ResidualVector &f) const
+    {
+        LastProjection &last = lastProjection();
+        last.owner = this;
+        last.q = x;
+        last.f = f;
+    }
+};
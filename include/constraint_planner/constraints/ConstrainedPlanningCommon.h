@@ -9,11 +9,18 @@
 #include <ompl/geometric/PathGeometric.h>
 
 #include <constraint_planner/constraints/ConstraintFunction.h>
+#include <constraint_planner/kinematics/parallel_ik.h>
 #include <constraint_planner/base/jy_ConstrainedValidStateSampler.h>
 #include <ompl/base/ConstrainedSpaceInformation.h>
 #include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
 // #include <ompl/base/spaces/constraint/ProjectedStateSpace.h>
 #include <constraint_planner/base/jy_ProjectedStateSpace.h>
+#include <constraint_planner/base/jy_ObjectStateSampler.h>
+#include <constraint_planner/base/jy_SampleProducer.h>
+#include <constraint_planner/planner/NoRandomSampleSpace.h>
+#include <ompl/base/spaces/constraint/AtlasChart.h>
+#include <ompl/base/spaces/constraint/AtlasStateSpace.h>
+#include <ompl/base/spaces/constraint/TangentBundleStateSpace.h>
 
 #include <ompl/geometric/planners/rrt/RRT.h>
 #include <ompl/geometric/planners/rrt/RRTConnect.h>
@@ -26,12 +33,37 @@
 #include <constraint_planner/base/jy_GoalLazySamples.h>
 
 #include <ompl/base/spaces/SE3StateSpace.h>
+
+#include <chrono>
 namespace ob = ompl::base;
 namespace og = ompl::geometric;
 namespace om = ompl::magic;
 namespace ot = ompl::tools;
 using namespace Eigen;
 using namespace std;
+enum SPACE_TYPE
+{
+    PJ = 0, // jy_ProjectedStateSpace
+    AT = 1, // AtlasStateSpace
+    TB = 2  // TangentBundleStateSpace
+};
+
+std::istream &operator>>(std::istream &in, enum SPACE_TYPE &type)
+{
+    std::string token;
+    in >> token;
+    if (token == "PJ")
+        type = PJ;
+    else if (token == "AT")
+        type = AT;
+    else if (token == "TB")
+        type = TB;
+    else
+        in.setstate(std::ios_base::failbit);
+
+    return in;
+}
+
 enum PLANNER_TYPE
 {
     RRT,
@@ -73,28 +105,91 @@ struct ConstrainedOptions
     double time;
     unsigned int tries;
     double range;
+    unsigned int ik_seeds;        // random IK seeds tried in parallel per goal object pose
+    double bounce_distance;       // newPRM expansion step radius (tangent space near samples), 0 for uniform bounces
+    bool soa_nn;                  // new* planners index their states in jy_NearestNeighborsSoA instead of OMPL's default
+    parallel_ik::SCORE ik_score; // which valid goal the seeds return, a ranking runs all of them, FIRST_ACCEPTED the fewest
+    PROJECTION_TYPE projection;
+    GEODESIC_TYPE geodesic;
+    unsigned int geodesic_cache;      // motions jy_ProjectedStateSpace remembers (LRU), 0 walks every one again
+    bool object_sampling;             // uniform samples from object poses + IK instead of projected joint vectors
+    Vector3d object_low, object_high; // workspace box of the sampled object position
+    double object_angle;              // max angle of the sampled object orientation from the start one
+    bool quasi_random;                // joint vectors from a scrambled Halton sequence, object sampling only uses them on fallback
+    unsigned int sample_threads;      // background valid-sample producers, 0 samples inline on the planning thread
+    unsigned int sample_queue;        // states the producers keep ready
+    unsigned int stage_reorder;       // valid sampler reorders its checks by measured cost every this many samples, 0 keeps bounds, constraint, collision
+};
+
+struct AtlasOptions
+{
+    double epsilon;     // max distance from a chart to the manifold inside its validity region
+    double rho;         // max radius of a chart's validity region
+    double exploration; // fraction of samples spent growing the frontier charts
+    double alpha;       // max angle between a chart and the manifold inside its validity region
+    bool separate;      // leave the charts overlapping (no halfspaces) in the atlas space
+    unsigned int charts; // max charts created per extension
+};
+
+/* what the atlas has built so far. OMPL does not expose the chart construction itself : a chart computes its
+   tangent basis from the constraint's jacobian(), and so does every projection onto a chart, the time is the one
+   measured in jacobian() during the last solve */
+struct AtlasStats
+{
+    std::size_t charts;
+    double frontier;         ///< percentage of charts on the frontier
+    std::size_t memory;      ///< bytes in chart origins and tangent bases, halfspaces not counted
+    unsigned long jacobians; ///< jacobian() calls during the last solve
+    double jacobian_time;    ///< seconds in them, summed over the threads
 };
 
 class ConstrainedProblem
 {
 public:
-    ConstrainedProblem(ob::StateSpacePtr space_, ChainConstraintPtr constraint_)
-        : space(std::move(space_)), constraint(std::move(constraint_))
+    /* atlas charts are built from the constraint's analytic jacobian like every projection */
+    ConstrainedProblem(enum SPACE_TYPE type_, ob::StateSpacePtr space_, ChainConstraintPtr constraint_)
+        : type(type_), space(std::move(space_)), constraint(std::move(constraint_))
     {
-        OMPL_INFORM("Using Projection-Based State Space!");
-        css = std::make_shared<jy_ProjectedStateSpace>(space, constraint);
-        csi = std::make_shared<ob::ConstrainedSpaceInformation>(css);
+        // charts need a full rank jacobian on the manifold, the angle residual's is rank deficient there
+        if (type != PJ && constraint->getCoDimension() < 6)
+            throw ompl::Exception("ConstrainedProblem: the atlas and tangent bundle spaces need LOG_MAP_RESIDUAL");
+        constraint->setRecordJacobians(type != PJ);
+
+        switch (type)
+        {
+        case PJ:
+            OMPL_INFORM("Using Projection-Based State Space!");
+            css = std::make_shared<jy_ProjectedStateSpace>(space, constraint);
+            csi = std::make_shared<ob::ConstrainedSpaceInformation>(css);
+            break;
+        case AT:
+            OMPL_INFORM("Using Atlas-Based State Space!");
+            css = std::make_shared<ob::AtlasStateSpace>(space, constraint);
+            csi = std::make_shared<ob::ConstrainedSpaceInformation>(css);
+            break;
+        case TB:
+            OMPL_INFORM("Using Tangent Bundle-Based State Space!");
+            css = std::make_shared<ob::TangentBundleStateSpace>(space, constraint);
+            csi = std::make_shared<ob::TangentBundleSpaceInformation>(css);
+            break;
+        }
         css->setup();
         ss = std::make_shared<og::SimpleSetup>(csi);
 
-        csi->setValidStateSamplerAllocator([](const ob::SpaceInformation *si) -> std::shared_ptr<ob::ValidStateSampler> {
-            return std::make_shared<jy_ConstrainedValidStateSampler>(si);
+        csi->setValidStateSamplerAllocator([this](const ob::SpaceInformation *si) -> std::shared_ptr<ob::ValidStateSampler> {
+            auto sampler = std::make_shared<jy_ConstrainedValidStateSampler>(si, producer);
+            sampler->setReorderInterval(c_opt.stage_reorder);
+            return sampler;
         });
 
         base_serve = grp.base_serve;
         base_main = grp.base_main;
         obj_Sgrasp = grp.obj_Sgrasp;
         obj_Mgrasp = grp.obj_Mgrasp;
+
+        // closed-form IK goals are filtered with the joint limits the planner samples in (both arms share them)
+        const ob::RealVectorBounds &bounds = space->as<ob::RealVectorStateSpace>()->getBounds();
+        panda_ik_pool::setJointLimits(Map<const Vector7d>(bounds.low.data()), Map<const Vector7d>(bounds.high.data()));
     }
 
     /* . The distance between each point in the discrete geodesic is tuned by the "delta" parameter
@@ -109,13 +204,115 @@ public:
         c_opt.tolerance2 = 0.025;  // 1degree
         c_opt.time = 90.;
         c_opt.tries = 200;
+        c_opt.ik_seeds = 48;
+        c_opt.bounce_distance = 1.0;
+        c_opt.soa_nn = true;
+        c_opt.ik_score = parallel_ik::MANIPULABILITY;
+        c_opt.projection = BOUNDED_PROJECTION;
+        c_opt.geodesic = PREDICTOR_CORRECTOR;
+        c_opt.geodesic_cache = 10000;
+        c_opt.object_sampling = true;
+        c_opt.object_low = Vector3d(1.0, -0.3, 0.7);
+        c_opt.object_high = Vector3d(1.3, 0.4, 1.2);
+        c_opt.object_angle = M_PI * 2 / 3;
+        c_opt.quasi_random = false;
+        c_opt.sample_threads = 0; // opt-in, e.g. hardware_concurrency() / 2 with the checker's scene replicas on
+        c_opt.sample_queue = 1024;
+        c_opt.stage_reorder = 256;
         // c_opt.range = 1.5;
 
         constraint->setTolerance(c_opt.tolerance1, c_opt.tolerance2);
         constraint->setMaxIterations(c_opt.tries);
+        constraint->setProjectionType(c_opt.projection);
 
         css->setDelta(c_opt.delta);
         css->setLambda(c_opt.lambda);
+        if (type == PJ)
+        {
+            css->as<jy_ProjectedStateSpace>()->setGeodesicType(c_opt.geodesic);
+            css->as<jy_ProjectedStateSpace>()->getGeodesicCache().setCapacity(c_opt.geodesic_cache);
+
+            // one sequence for every sampler, the producers and the planners draw disjoint blocks of it
+            if (c_opt.quasi_random)
+                halton = std::make_shared<ob::HaltonSequence>(space->getDimension());
+            else
+                halton.reset();
+
+            // the producer's own samplers are made here without it, the planners' ones pop from it
+            if (c_opt.sample_threads > 0)
+                producer = std::make_shared<jy_SampleProducer>(
+                    csi, [this] { return allocProjectedSampler(css->as<jy_ProjectedStateSpace>()); },
+                    c_opt.sample_threads, c_opt.sample_queue);
+            css->setStateSamplerAllocator([this](const ob::StateSpace *space) -> ob::StateSamplerPtr {
+                auto &&sampler = allocProjectedSampler(space->as<jy_ProjectedStateSpace>());
+                sampler->setProducer(producer);
+                return sampler;
+            });
+        }
+    }
+
+    /* uniform sampler of the projected space : object pose + IK or projected joint vectors, pseudo or quasi-random */
+    std::shared_ptr<jy_ProjectedStateSampler> allocProjectedSampler(const jy_ProjectedStateSpace *projected) const
+    {
+        ob::StateSamplerPtr ambient;
+        if (halton)
+            ambient = std::make_shared<ob::NoRandomSampler>(projected->getSpace().get(), halton);
+        else
+            ambient = projected->getSpace()->allocStateSampler();
+
+        if (!c_opt.object_sampling)
+            return std::make_shared<jy_ProjectedStateSampler>(projected, ambient);
+
+        auto &&sampler = std::make_shared<jy_ObjectStateSampler>(projected, ambient,
+                                                                 base_serve, base_main, obj_Sgrasp, obj_Mgrasp);
+        sampler->setWorkspace(c_opt.object_low, c_opt.object_high);
+        sampler->setOrientation(Quaterniond::Identity(), c_opt.object_angle);
+        return sampler;
+    }
+
+    /* rho follows delta so charts cover the same steps the projection-based space takes */
+    void setAtlasOptions()
+    {
+        if (!(type == AT || type == TB))
+            return;
+
+        a_opt.epsilon = 0.05;
+        a_opt.rho = c_opt.delta * 2.5;
+        a_opt.exploration = 0.5;
+        a_opt.alpha = M_PI / 8;
+        a_opt.separate = false;
+        a_opt.charts = 100;
+
+        auto &&atlas = css->as<ob::AtlasStateSpace>();
+        atlas->setExploration(a_opt.exploration);
+        atlas->setEpsilon(a_opt.epsilon);
+        atlas->setRho(a_opt.rho);
+        atlas->setAlpha(a_opt.alpha);
+        atlas->setMaxChartsPerExtension(a_opt.charts);
+        if (type == AT)
+            atlas->setSeparated(!a_opt.separate);
+        atlas->setup();
+    }
+
+    AtlasStats getAtlasStats() const
+    {
+        AtlasStats stats{0, 0., 0, 0, 0.};
+        if (!(type == AT || type == TB))
+            return stats;
+
+        auto &&atlas = css->as<ob::AtlasStateSpace>();
+        const unsigned int n = constraint->getAmbientDimension();
+        const unsigned int k = constraint->getManifoldDimension();
+        stats.charts = atlas->getChartCount();
+        if (stats.charts == 0)
+            return stats;
+        stats.frontier = atlas->estimateFrontierPercent();
+        stats.memory = stats.charts * (n + 2 * n * k) * sizeof(double);
+
+        JacobianStats jacobian = constraint->getJacobianStats();
+        stats.jacobians = jacobian.calls;
+        stats.jacobian_time = jacobian.time;
+        return stats;
     }
 
     void setStartAndGoalStates()
@@ -131,6 +328,14 @@ public:
             samplegoal = sampleIKgoal(result);
         } while (!samplegoal);
         sgoal = result;
+
+        // the atlas grows from charts on the start and the goal
+        if (type == AT || type == TB)
+        {
+            css->as<ob::AtlasStateSpace>()->anchorChart(sstart.get());
+            css->as<ob::AtlasStateSpace>()->anchorChart(sgoal.get());
+        }
+
         ss->setStartAndGoalStates(sstart, sgoal);
         csi->printState(result);
     }
@@ -162,7 +367,71 @@ public:
             ss->setGoal(goal);
         }
 
+        constraint->resetProjectionStats();
+        constraint->resetJacobianStats();
+        panda_ik_pool::resetStats();
+        if (type == PJ)
+        {
+            // the cached collision results belong to the last scene
+            css->as<jy_ProjectedStateSpace>()->resetGeodesicStats();
+            css->as<jy_ProjectedStateSpace>()->getGeodesicCache().clear();
+            css->as<jy_ProjectedStateSpace>()->getGeodesicCache().resetStats();
+        }
+        if (producer)
+            producer->resetStats();
+        auto checker = std::dynamic_pointer_cast<KinematicChainValidityChecker>(ss->getStateValidityChecker());
+        panda_sphere_broadphase *broadphase = checker ? checker->getSphereBroadphase() : nullptr;
+        if (broadphase)
+            broadphase->resetStats();
+        if (checker)
+        {
+            checker->getValidityCache().resetStats();
+            checker->resetCertificateStats();
+        }
+        jy_SampleProductionScope production(producer); // the workers are joined even if solve() throws
         ob::PlannerStatus stat = ss->solve(c_opt.time);
+        production.stop();
+        if (producer)
+        {
+            SampleProducerStats prod = producer->getStats();
+            OMPL_INFORM("Sample producer : %lu states at %.0f/s, %lu rejected, %lu consumed, %lu starved pops, %lu/%lu queued",
+                        prod.produced, prod.rate, prod.rejected, prod.consumed, prod.starved, prod.depth, prod.capacity);
+        }
+        if (broadphase && checker->getBroadphase())
+        {
+            BroadphaseStats early = broadphase->getStats();
+            const unsigned long total = early.free + early.colliding + early.uncertain;
+            OMPL_INFORM("Sphere broadphase : %lu checks, %.1f%% free, %.1f%% colliding, %.1f%% left to the exact check",
+                        total, total ? 100. * early.free / total : 0., total ? 100. * early.colliding / total : 0.,
+                        total ? 100. * early.uncertain / total : 0.);
+        }
+        if (checker)
+        {
+            ValidityCacheStats cache = checker->getValidityCache().getStats();
+            OMPL_INFORM("Validity cache : %lu lookups, %.1f%% hits, %lu results stored in %lu slots",
+                        cache.lookups, 100 * cache.hit_rate, cache.inserts, cache.capacity);
+        }
+        if (checker && checker->getClearanceCertificates())
+            OMPL_INFORM("Clearance certificates : %lu free balls, %lu states settled without a check",
+                        checker->getCertificateCount(), checker->getCertifiedCount());
+        const unsigned long ik_solves = panda_ik_pool::getSolveCount();
+        OMPL_INFORM("Pooled IK : %lu solves, %.3f ms on average", ik_solves,
+                    ik_solves ? 1e3 * panda_ik_pool::getTotalSolveTime() / ik_solves : 0.);
+        ProjectionStats proj = constraint->getProjectionStats();
+        OMPL_INFORM("Projections : %lu calls, %lu succeeded, %.1f iterations on average, %lu stalled, %lu diverged",
+                    proj.calls, proj.successes, proj.calls ? double(proj.iterations) / proj.calls : 0., proj.stalled, proj.diverged);
+        if (type == PJ && c_opt.geodesic == PREDICTOR_CORRECTOR)
+        {
+            GeodesicStats geo = css->as<jy_ProjectedStateSpace>()->getGeodesicStats();
+            OMPL_INFORM("Geodesics : %lu calls, %lu steps, %.2f corrections per step, %lu halved steps, %lu full projections",
+                        geo.calls, geo.steps, geo.steps ? double(geo.corrections) / geo.steps : 0., geo.rejections, geo.fallbacks);
+        }
+        if (type == AT || type == TB)
+        {
+            AtlasStats atlas = getAtlasStats();
+            OMPL_INFORM("Atlas : %lu charts, %.2f%% frontier, %.1f KB of origins and bases, %lu jacobians in %.3f s (chart creation and projection)",
+                        atlas.charts, atlas.frontier, atlas.memory / 1024., atlas.jacobians, atlas.jacobian_time);
+        }
         dumpGraph("test");
         if (stat)
         {
@@ -181,7 +450,13 @@ public:
         }
         else
             OMPL_WARN("No solution found.");
-        
+        if (type == PJ)
+        {
+            GeodesicCacheStats cache = css->as<jy_ProjectedStateSpace>()->getGeodesicCache().getStats();
+            OMPL_INFORM("Geodesic cache : %lu lookups, %.1f%% hits, %lu evictions, %lu entries",
+                        cache.lookups, 100 * cache.hit_rate, cache.evictions, cache.entries);
+        }
+
         // start->as<ob::jy_GoalLazySamples>()->stopSampling();
         if (goalsampling)
             goal->as<ob::jy_GoalLazySamples>()->stopSampling();
@@ -207,7 +482,7 @@ public:
 
     bool startsampleIKgoal(const ob::jy_GoalLazySamples *gls, ob::State *result)
     {
-        std::shared_ptr<panda_ik> panda_ik_solver = std::make_shared<panda_ik>();
+        panda_ik &panda_ik_solver = panda_ik_pool::get();
         Affine3d base_obj;
         // closed chain
         base_obj.linear().setIdentity();
@@ -222,8 +497,8 @@ public:
         {
             // std::cout << tries << std::endl;
             bool serve, main;
-            serve = panda_ik_solver->randomSolve(target_serve, sol.segment<7>(0));
-            main = panda_ik_solver->randomSolve(target_main, sol.segment<7>(7));
+            serve = panda_ik_solver.randomSolve(target_serve, sol.segment<7>(0));
+            main = panda_ik_solver.randomSolve(target_main, sol.segment<7>(7));
             if (serve && main)
             {
                 if (gls->getSpaceInformation()->isValid(result))
@@ -241,8 +516,17 @@ public:
 
     bool sampleIKgoal(const ob::jy_GoalLazySamples *gls, ob::State *result)
     {
+        const ob::SpaceInformationPtr &si = gls->getSpaceInformation();
+        // called from the IK workers, each checks its own copy of the state
+        parallel_ik::ValidityCheckerFn is_valid = [&si](const Eigen::VectorXd &q) {
+            ob::State *state = si->allocState();
+            state->as<ob::ConstrainedStateSpace::StateType>()->copy(q);
+            bool valid = si->isValid(state);
+            si->freeState(state);
+            return valid;
+        };
+
         int stefan_tries = 500;
-        std::shared_ptr<panda_ik> panda_ik_solver = std::make_shared<panda_ik>();
         while (--stefan_tries)
         {
             Affine3d base_obj;
@@ -261,23 +545,8 @@ public:
             Affine3d target_main = base_main.inverse() * base_obj * obj_Mgrasp;
 
             Eigen::Map<Eigen::VectorXd> &sol = *result->as<ob::ConstrainedStateSpace::StateType>();
-            int tries = 50;
-            while (--tries)
-            {
-                // std::cout << tries << std::endl;
-                bool serve, main;
-                serve = panda_ik_solver->randomSolve(target_serve, sol.segment<7>(0));
-                main = panda_ik_solver->randomSolve(target_main, sol.segment<7>(7));
-                if (serve && main)
-                {
-                    if (gls->getSpaceInformation()->isValid(result))
-                    {
-                        return true;
-                    }
-                }
-                else
-                    break;
-            }
+            if (parallel_ik::get().solve(target_serve, target_main, c_opt.ik_seeds, is_valid, sol, c_opt.ik_score))
+                return true;
         }
         return false;
     }
@@ -285,7 +554,7 @@ public:
     bool sampleIKgoal(ob::State *result)
     {
         int stefan_tries = 500;
-        std::shared_ptr<panda_ik> panda_ik_solver = std::make_shared<panda_ik>();
+        panda_ik &panda_ik_solver = panda_ik_pool::get();
         while (--stefan_tries)
         {
             Affine3d base_obj;
@@ -305,10 +574,10 @@ public:
             {
                 // std::cout << tries << std::endl;
                 bool serve, main;
-                // serve = panda_ik_solver->randomSolve(target_serve, sol.segment<7>(0));
-                // main = panda_ik_solver->randomSolve(target_main, sol.segment<7>(7));
-                serve = panda_ik_solver->solve(grp.start.segment<7>(0), target_serve, sol.segment<7>(0));
-                main = panda_ik_solver->solve(grp.start.segment<7>(7), target_main, sol.segment<7>(7));
+                // serve = panda_ik_solver.randomSolve(target_serve, sol.segment<7>(0));
+                // main = panda_ik_solver.randomSolve(target_main, sol.segment<7>(7));
+                serve = panda_ik_solver.solve(grp.start.segment<7>(0), target_serve, sol.segment<7>(0));
+                main = panda_ik_solver.solve(grp.start.segment<7>(7), target_main, sol.segment<7>(7));
                 if (serve && main)
                 {
                     if (csi->isValid(result))
@@ -356,6 +625,14 @@ public:
         return std::move(planner);
     }
 
+    template <typename _T>
+    std::shared_ptr<_T> withSoANearestNeighbors(std::shared_ptr<_T> planner)
+    {
+        if (c_opt.soa_nn && jy_soa::supports(csi))
+            planner->template setNearestNeighbors<jy_NearestNeighborsSoA>();
+        return planner;
+    }
+
     template <typename _T>
     std::shared_ptr<_T> createPlannerRangeProj(const std::string &projection)
     {
@@ -385,14 +662,18 @@ public:
             break;
 
         case newRRT:
-            p = createPlanner<og::newRRT>();
+            p = withSoANearestNeighbors(createPlanner<og::newRRT>());
             break;
 
         case newPRM:
-            p = createPlanner<og::newPRM>();
+        {
+            auto &&prm = withSoANearestNeighbors(createPlanner<og::newPRM>());
+            prm->setBounceDistance(c_opt.bounce_distance);
+            p = prm;
             break;
+        }
         case newRRTConnect:
-            p = createPlannerRange<og::newRRTConnect>();
+            p = withSoANearestNeighbors(createPlannerRange<og::newRRTConnect>());
             break;
         }
         return p;
@@ -404,6 +685,7 @@ public:
         ss->setPlanner(pp);
     }
 
+    enum SPACE_TYPE type;
     ob::StateSpacePtr space;
     ChainConstraintPtr constraint;
 
@@ -412,8 +694,11 @@ public:
     ob::ConstrainedSpaceInformationPtr csi;
     ob::PlannerPtr pp;
     og::SimpleSetupPtr ss;
+    jy_SampleProducerPtr producer;
+    ob::HaltonSequencePtr halton;
 
     struct ConstrainedOptions c_opt;
+    struct AtlasOptions a_opt;
     Affine3d obj_Sgrasp, obj_Mgrasp, base_serve, base_main;
     grasping_point grp;
 
@@ -19,6 +19,7 @@
 
 #include <constraint_planner/kinematics/KinematicChain.h>
 #include <constraint_planner/kinematics/panda_model_updater.h>
+#include <constraint_planner/constraints/ClosedChainConstraint.h>
 
 #include <ctime>
 
@@ -26,12 +27,21 @@
 #include <unsupported/Eigen/MatrixFunctions>
 
 using namespace std;
-class KinematicChainConstraint : public ompl::base::Constraint
+
+/* how the relative orientation error of the two end-effectors enters the residual */
+enum ORIENTATION_RESIDUAL
+{
+    ANGLE_RESIDUAL,  // 4 residuals : translation + the angle of init^-1 * result
+    LOG_MAP_RESIDUAL // 6 residuals : translation + the rotation vector of init^-1 * result
+};
+
+/* kinematics both closed chain constraints share : the arm bases, the grasp offset of the serve arm and the
+   relative end-effector pose at the start configuration */
+class DualPandaChain
 {
 public:
-    KinematicChainConstraint(unsigned int links) : ompl::base::Constraint(14, 4)
+    DualPandaChain()
     {
-
         grasping_point grp;
          for (int i = 0; i < 7; i++)
         {
@@ -54,108 +64,67 @@ public:
         // std::cout << "init_main " << init_main.linear() << std::endl;
         // std::cout << "relative position : " << init.translation().transpose() << std::endl;
         // std::cout << "relative position : " << init.linear().eulerAngles(0, 1, 2).transpose() << std::endl;
-        lower_limit << -2.8973, -1.7628, -2.8973, -3.0718, -2.8973, -0.0175, -2.8973, -2.8973, -1.7628, -2.8973, -3.0718, -2.8973, -0.0175, -2.8973;
-        upper_limit << 2.8973, 1.7628, 2.8973, -0.0698, 2.8973, 3.7525, 2.8973, 2.8973, 1.7628, 2.8973, -0.0698, 2.8973, 3.7525, 2.8973;
-
-        theta = 0.99995;
-        beta1 = 0.1;
-        beta2 = 0.2; // 0.25 
-        trust_radius_min = 5*10e-4;
-        maxIterations = 100; //default : 50
-
     }
 
-    Eigen::DiagonalMatrix<double, 14> scaling_matrix(const Eigen::Ref<const Eigen::VectorXd> &x) const
+    static Eigen::Matrix3d skew_symmetric(Eigen::Vector3d x)
     {
-        Eigen::Matrix<double, 14, 1> new_j = new_jacobian(x);
-        Eigen::Matrix<double, 14, 1> v;
-        for (int i = 0; i < 14; i++)
-        {
-            if (new_j[i] < 0)
-                v[i] = x[i] - upper_limit[i];
-            else
-                v[i] = x[i] - lower_limit[i];
-        }
-        for (int i = 0; i < 14; i++)
-            v[i] = pow(abs(v[i]), -0.5);
-        return v.asDiagonal();
+        Eigen::Matrix3d result;
+        result.setZero();
+        result(0, 1) = -x[2];
+        result(0, 2) = x[1];
+        result(1, 0) = x[2];
+        result(1, 2) = -x[0];
+        result(2, 0) = -x[1];
+        result(2, 1) = x[0];
+        return result;
     }
 
-    Eigen::DiagonalMatrix<double, 14> scaling_matrix_inv(const Eigen::Ref<const Eigen::VectorXd> &x) const
-    {
-        Eigen::Matrix<double, 14, 1> new_j = new_jacobian(x);
-        Eigen::Matrix<double, 14, 1> v;
-        for (int i = 0; i < 14; i++)
-        {
-            if (new_j[i] < 0)
-                v[i] = x[i] - upper_limit[i];
-            else
-                v[i] = x[i] - lower_limit[i];
-        }
-        for (int i = 0; i < 14; i++)
-            v[i] = pow(abs(v[i]), 0.5);
-        return v.asDiagonal();
-    }
+    /* kinematics model of both arms */
+    FrankaModelUpdater &getArmModel() { return *panda_arm; }
+    const FrankaModelUpdater &getArmModel() const { return *panda_arm; }
 
-    double new_function(const Eigen::Ref<const Eigen::VectorXd> &x) const
+protected:
+    /* lt : serve end-effector (with offset_R), rt : main end-effector, both in the world frame */
+    void endEffectorPoses(const Eigen::Matrix<double, 14, 1> &x, Eigen::Affine3d &lt, Eigen::Affine3d &rt) const
     {
-        Eigen::VectorXd f(getCoDimension());
-        function(x, f);
-        return 0.5 * f.squaredNorm();
+        lt = base_serve * panda_arm->getTransform(x.segment<7>(0)) * offset_R;
+        rt = base_main * panda_arm->getTransform(x.segment<7>(7));
     }
 
-    Eigen::Matrix<double, 14, 1> new_jacobian(const Eigen::Ref<const Eigen::VectorXd> &x) const
+    /* also fills jaco_serve, jaco_main : [linear; angular] of each end-effector, expressed in its arm's base frame */
+    void endEffectorPoses(const Eigen::Matrix<double, 14, 1> &x, Eigen::Affine3d &lt, Eigen::Affine3d &rt,
+                          Eigen::Matrix<double, 6, 7> &jaco_serve, Eigen::Matrix<double, 6, 7> &jaco_main) const
     {
-        Eigen::VectorXd f(getCoDimension());
-        Eigen::MatrixXd j(getCoDimension(), n_);
-        function(x, f);
-        jacobian(x, j);
-        return j.transpose() * f;
+        panda_arm->getTransformAndJacobian(x.segment<7>(0), lt, jaco_serve);
+        panda_arm->getTransformAndJacobian(x.segment<7>(7), rt, jaco_main);
+        lt = base_serve * lt * offset_R;
+        rt = base_main * rt;
     }
 
-    double model_function(const Eigen::Ref<const Eigen::VectorXd> &x, const Eigen::Ref<const Eigen::VectorXd> &p) const
+    static void pandaJointLimits(Eigen::Matrix<double, 14, 1> &lower, Eigen::Matrix<double, 14, 1> &upper)
     {
-        Eigen::VectorXd f(getCoDimension());
-        Eigen::MatrixXd j(getCoDimension(), n_);
-
-        function(x, f);
-        jacobian(x, j);
-        auto result = 0.5 * f.transpose() * f + f.transpose() * j * p + 0.5 * p.transpose() * j.transpose() * j * p;
-        return result[0];
+        lower << -2.8973, -1.7628, -2.8973, -3.0718, -2.8973, -0.0175, -2.8973, -2.8973, -1.7628, -2.8973, -3.0718, -2.8973, -0.0175, -2.8973;
+        upper << 2.8973, 1.7628, 2.8973, -0.0698, 2.8973, 3.7525, 2.8973, 2.8973, 1.7628, 2.8973, -0.0698, 2.8973, 3.7525, 2.8973;
     }
 
-    Eigen::Matrix<double, 14, 1> alpha_p(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::VectorXd p) const
-    {
-        Eigen::Matrix<double, 14, 1> result, t;
-        for (int i = 0; i < 14; i++)
-        {
-            if ( p[i] > 0 )
-                t[i] = (upper_limit[i] - x[i]) / p[i];
-            else
-                t[i] = (lower_limit[i] - x[i]) / p[i];
-        }
+    Eigen::Matrix<double, 7, 1> q_1st, q_3rd;
+    Eigen::Matrix<double, 7, 1> qinit_serve, qinit_main;
+    Eigen::Affine3d init_serve, init_main, init, init_tr;
 
-        // for (int i = 0; i < 14; i++)
-        // {
-        //     if (p[i] == 0)
-        //         t[i] = std::numeric_limits<double>::infinity();
-        //     else
-        //         t[i] = max((lower_limit[i] - x[i]) / p[i], (upper_limit[i] - x[i]) / p[i]);
-        // }
-        double lambda = t.minCoeff();
-        if (lambda > 1)
-            result = p;
-        else
-            result = max(theta, 1 - p.norm()) * lambda * p;
+    std::shared_ptr<FrankaModelUpdater> panda_arm;
+    Eigen::Matrix<double, 4, 4> init_;
 
-        return result;
-    }
+    Eigen::Affine3d base_serve, base_main;
+    Eigen::Affine3d offset_R;
+};
 
-    double cauchy_ratio(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Matrix<double, 14, 1> p_cauchy, Eigen::Matrix<double, 14, 1> p_current) const
+class KinematicChainConstraint : public ClosedChainConstraint<2, 4>, public DualPandaChain
+{
+public:
+    KinematicChainConstraint(unsigned int links)
     {
-        double numerator  = model_function(x, Eigen::VectorXd::Zero(14)) - model_function(x, alpha_p(x, p_current));
-        double denominator = model_function(x, Eigen::VectorXd::Zero(14)) - model_function(x, alpha_p(x, p_cauchy));
-        return numerator / denominator;
+        pandaJointLimits(lower_limit, upper_limit);
+        maxIterations = 100; //default : 50
     }
 
     // bool project(Eigen::Ref<Eigen::VectorXd> x) const override
@@ -278,227 +247,153 @@ public:
     //     }
     // }
 
-    double quad_solve(Eigen::Matrix<double, 14, 14> D, Eigen::Matrix<double, 14, 1> p_cauchy, Eigen::Matrix<double, 14, 1> p_newton, double trust_radius) const
+    /*actual constraint function, state "x" from the ambient space */
+    void computeResidual(const StateVector &x, ResidualVector &out) const override
     {
-        Eigen::Matrix<double, 14, 1> p_diff = p_newton - p_cauchy;
-        // a = (p_diff).transpose() * D.transpose() * D * p_diff;
-        double a = (D * p_diff).squaredNorm();
-        auto b = 2 * p_diff.transpose() * D * D * (2 * p_cauchy - p_newton);
-        double c = (D * (2 * p_cauchy - p_newton)).squaredNorm() - pow(trust_radius, 2);
-        // b = -2 * p_diff.transpose() * D.transpose() * D * p_diff + p_cauchy.transpose() * D.transpose() * D * p_diff + (p_diff).transpose() * D.transpose() * D * p_cauchy;
-        // c = (2*p_cauchy.transpose() - p_newton.transpose()) * D.transpose() * D * (2 * p_cauchy - p_newton);
-        double det = b[0] * b[0] - 4 * a * c;
-        if (det >= 0)
-            return (-b[0] + sqrt(det)) / (2 * a);
-        else
-        {
-            // cout << "cannot calculate" << endl;
-            return 0;
-        }
+        Eigen::Affine3d lt, rt;
+        endEffectorPoses(x, lt, rt);
+        residual(lt, rt, out);
     }
 
-    bool project(Eigen::Ref<Eigen::VectorXd> x) const override
+    /* residual and analytic jacobian together : both arms' poses and jacobians are computed once per x.
+       OMPL's default jacobian is central differences, which costs 28 extra function() calls */
+    void computeResidual(const StateVector &x, ResidualVector &f, JacobianMatrix &j) const override
     {
-        // Newton's method
-        unsigned int iter = 0;
-        double norm1 = 0;
-        double norm2 = 0;
-        Eigen::VectorXd f(getCoDimension());
-        Eigen::MatrixXd j(getCoDimension(), n_);
-
-        const double squaredTolerance1 = tolerance1_ * tolerance1_;
-        const double squaredTolerance2 = tolerance2_ * tolerance2_;
-        function(x, f);
-        while ( ( (norm1 = f.head(3).squaredNorm()) > squaredTolerance1  || (norm2 = f[3]*f[3]) > squaredTolerance2 )
-                    && iter++ < maxIterations)
-        {
-            jacobian(x, j);
-            x -= 0.20 * j.jacobiSvd(Eigen::ComputeThinU | Eigen::ComputeThinV).solve(f);
+        Eigen::Affine3d lt, rt;
+        Eigen::Matrix<double, 6, 7> jaco_serve, jaco_main;
+        endEffectorPoses(x, lt, rt, jaco_serve, jaco_main);
 
-            // OMPL_INFORM("ITER : %d  / norm1 : %f  / norm2 : %f  "  , iter, norm1, f[3]*f[3]);
-            function(x, f);
-        }
-        // cout << "F : " << f.transpose() << endl;
-        // cout << "f tail : " << f.tail(3).transpose() << endl;
-        // cout << f.tail(3).squaredNorm() << endl;
-        // cout << "x          : " << x.transpose() << endl;
-        if ((norm1 < squaredTolerance1) && (norm2 < squaredTolerance2))
-        {
-            // OMPL_INFORM("ITER : %d  / norm1 : %f  / norm2 : %f  "  , iter, norm1, norm2);
-            return true;
-        }
-        else    
-            return false;
-        // return (norm1 < squaredTolerance1) && (norm2 < squaredTolerance2);
+        residual(lt, rt, f);
+        residualJacobian(lt, rt, jaco_serve, jaco_main, j);
     }
 
-
-
-    /*actual constraint function, state "x" from the ambient space */
-    void function(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Ref<Eigen::VectorXd> out) const override
+private:
+    void residual(const Eigen::Affine3d &lt, const Eigen::Affine3d &rt, ResidualVector &out) const
     {
-        Eigen::VectorXd &&temp = x.segment(0, 7);
-        Eigen::VectorXd &&temp2 = x.segment(7, 7);
-
-        // Eigen::Affine3d lt = base_serve * panda_model->getTransform(temp);
-        Eigen::Affine3d lt = base_serve * panda_arm->getTransform(temp) * offset_R;
-        Eigen::Affine3d rt = base_main * panda_arm->getTransform(temp2);
-
         Eigen::Affine3d result = lt.inverse() * rt;
-
-        Eigen::VectorXd p = result.translation() - init.translation();
-
-        // Eigen::Vector3d r = result.linear().eulerAngles(0, 1, 2) - init.linear().eulerAngles(0, 1, 2);
+        Eigen::Vector3d p = result.translation() - init.translation();
 
         Eigen::Quaterniond cur_q(result.linear());
         Eigen::Quaterniond ori_q(init.linear());
         double r = cur_q.angularDistance(ori_q);
 
-
-        // std::cout << r << std::endl;
-        
-        // Eigen::Matrix3d r_diff = init.linear().transpose() * result.linear();
-        // Eigen::Vector3d r = r_diff.eulerAngles(0, 1, 2);
-        // Eigen::Vector3d r = result.linear().eulerAngles(0, 1, 2);
-
-
-        // Eigen::AngleAxisd r_angleaxis(r_diff);
-        // Eigen::Vector3d r = r_angleaxis.axis() * r_angleaxis.angle();
-        // r = lt.linear().inverse() * init_main.linear() * r;
-        // 
         out[0] = -p[0];
         out[1] = -p[1];
         out[2] = -p[2];
         out[3] = r;
-        // out[4] = r[1];
-        // out[5] = r[2];
     }
 
-    /* this is very computationally intensive, and providing an analytic derivative is preferred. We provide a simple scrip */
-    // void jacobian(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::Ref<Eigen::MatrixXd> out) const override
-    // {
-    //     Eigen::VectorXd &&q_temp = x;
-    //     Eigen::Affine3d lt = base_serve * panda_arm->getTransform(q_temp.segment(0, 7)) * offset_R;
-    //     Eigen::Affine3d rt = base_main * panda_arm->getTransform(q_temp.segment(7, 7));
-    //     Eigen::Affine3d result = lt.inverse() * rt;
-    //     Eigen::Matrix3d r_diff = init.linear().transpose() * result.linear();
-
-    //     Eigen::Vector3d rpy = result.linear().eulerAngles(0, 1, 2);
-    //     // rpy(0) = atan2(result(2, 1), result(2, 2));
-    //     // rpy(1) = -asin(result(2, 0));
-    //     // rpy(2) = atan2(result(1, 0), result(0, 0));
-        
-    //     // E_rpy(0,0) = cos(rpy(2))/cos(rpy(1));
-    //     // E_rpy(0,1) = sin(rpy(2))/cos(rpy(1));
-    //     // E_rpy(0,2) = 0.0;
-
-    //     // E_rpy(1,0) = sin(rpy(2));
-    //     // E_rpy(1,1) = cos(rpy(2));
-    //     // E_rpy(1,2) = 0.0;
-
-    //     // E_rpy(2,0) = -cos(rpy(2))*sin(rpy(1))/cos(rpy(1));
-    //     // E_rpy(2,1) = sin(rpy(2))*sin(rpy(1))/cos(rpy(1));
-    //     // E_rpy(2,2) = 1.0;
-
-    //     Eigen::MatrixXd offset_R2 = Eigen::MatrixXd::Zero(6, 6);
-    //     offset_R2.block<3, 3>(0, 0) = offset_R.linear();
-    //     offset_R2.block<3, 3>(3, 3) = offset_R.linear();
-        
-    //     Eigen::MatrixXd jaco_l_temp = offset_R2 * panda_arm->getJacobian(q_temp.segment(0, 7));
-    //     Eigen::MatrixXd jaco_r_temp = panda_arm->getJacobian(q_temp.segment(7, 7));
-    //     Eigen::Matrix<double, 6, 7> jaco_l, jaco_r;
-    //     jaco_l.topRows(3) = jaco_l_temp.bottomRows(3);
-    //     jaco_l.bottomRows(3) = jaco_l_temp.topRows(3);
-        
-    //     jaco_r.topRows(3) = jaco_r_temp.bottomRows(3);
-    //     jaco_r.bottomRows(3) = jaco_r_temp.topRows(3);
-        
-    //     Eigen::MatrixXd omega_1st = Eigen::MatrixXd::Zero(6, 6);
-    //     Eigen::MatrixXd omega_3rd = Eigen::MatrixXd::Zero(6, 6);
-    //     omega_1st.block<3, 3>(0, 0) = lt.linear().inverse();
-    //     omega_1st.block<3, 3>(3, 3) = lt.linear().inverse();
-    //     omega_3rd.block<3, 3>(0, 0) = result.linear() * (rt.linear().inverse());
-    //     omega_3rd.block<3, 3>(3, 3) = result.linear() * (rt.linear().inverse());
-    //     // std::cout << result.linear() << std::endl;
-        
-    //     Eigen::MatrixXd wrench = Eigen::MatrixXd::Zero(6, 6);
-    //     wrench.block<3, 3>(0, 0) = Eigen::Matrix3d::Identity();
-    //     wrench.block<3, 3>(3, 3) = Eigen::Matrix3d::Identity();
-    //     wrench.block<3, 3>(0, 3) = -skew_symmetric(result.translation());
-        
-        
-    //     std::cout << "wrench" << std::endl;
-    //     std::cout << wrench << std::endl;
-    //     Eigen::MatrixXd jaco(6, 14);
-    //     jaco.block<6, 7>(0, 0) = -wrench * omega_1st * jaco_l;
-    //     jaco.block<6, 7>(0, 7) = omega_3rd * jaco_r;
-
-    //     Eigen::MatrixXd e_matrix = Eigen::MatrixXd::Zero(6, 6);
-    //     e_matrix.block<3, 3>(0, 0) = Eigen::Matrix3d::Identity();
-    //     Eigen::Matrix3d e_R;
-    //     e_R << 1, sin(rpy[0]) * sin(rpy[1]) / cos(rpy[1]), -cos(rpy[0])*sin(rpy[1])/cos(rpy[1]), 
-    //             0, cos(rpy[0]), sin(rpy[0]),
-    //             0, -sin(rpy[0]) / cos(rpy[1]) , cos(rpy[0]) / cos(rpy[1]);
-    //     e_matrix.block<3, 3>(3, 3) = e_R ;
-
-    //     // out = e_matrix * jaco;
-    //     std::cout << result.linear() << std::endl;
-    //     std::cout << std::endl;
-    //     out = jaco;
-        
-    // }
-
-    void setTolerance(const double tolerance1, const double tolerance2)
+    /* jaco_serve, jaco_main : [linear; angular] of each end-effector, expressed in its arm's base frame */
+    void residualJacobian(const Eigen::Affine3d &lt, const Eigen::Affine3d &rt,
+                          const Eigen::Matrix<double, 6, 7> &jaco_serve, const Eigen::Matrix<double, 6, 7> &jaco_main,
+                          JacobianMatrix &out) const
     {
-        if (tolerance1 <= 0 || tolerance2 <= 0)
-            throw ompl::Exception("ompl::base::Constraint::setProjectionTolerance(): "
-                                  "tolerance must be positive.");
-        tolerance1_ = tolerance1;
-        tolerance2_ = tolerance2;
-        OMPL_INFORM("Set tolerance to %f and %f", tolerance1_, tolerance2_);
+        Eigen::Affine3d result = lt.inverse() * rt;
+
+        Eigen::Matrix<double, 3, 7> v_serve = base_serve.linear() * jaco_serve.topRows<3>();
+        Eigen::Matrix<double, 3, 7> w_serve = base_serve.linear() * jaco_serve.bottomRows<3>();
+        Eigen::Matrix<double, 3, 7> v_main = base_main.linear() * jaco_main.topRows<3>();
+        Eigen::Matrix<double, 3, 7> w_main = base_main.linear() * jaco_main.bottomRows<3>();
+
+        // p = lt.R^T (rt.p - lt.p)  -->  dp = lt.R^T (v_main - v_serve + [rt.p - lt.p]x w_serve)
+        Eigen::Matrix3d lt_inv = lt.linear().transpose();
+        Eigen::Vector3d d = rt.translation() - lt.translation();
+        out.block<3, 7>(0, 0) = lt_inv * (v_serve - skew_symmetric(d) * w_serve);
+        out.block<3, 7>(0, 7) = -lt_inv * v_main;
+
+        // r = |log(init.R^T * result.R)|  -->  dr = axis^T * init.R^T * lt.R^T (w_main - w_serve)
+        Eigen::AngleAxisd r_diff(init.linear().transpose() * result.linear());
+        if (r_diff.angle() > 1e-12)
+        {
+            Eigen::RowVector3d axis = r_diff.axis().transpose() * init.linear().transpose() * lt_inv;
+            out.block<1, 7>(3, 0) = -axis * w_serve;
+            out.block<1, 7>(3, 7) = axis * w_main;
+        }
+        else
+            out.row(3).setZero(); // r is not differentiable on the manifold, take the zero subgradient
     }
+};
 
-    bool isSatisfied(const Eigen::Ref<const Eigen::VectorXd> &x) const override
+/* Same closed chain with the orientation error kept as the rotation vector phi = log(init.R^T * result.R).
+   The angle residual has a kink on the manifold and a single row for three rotational directions, so its
+   Gauss-Newton steps only shrink the angle along the current axis; the rotation vector is smooth there and
+   gives the projection a full rank orientation block. |phi| is the angle, so tolerance2 keeps its meaning. */
+class KinematicChainLogConstraint : public ClosedChainConstraint<2, 6>, public DualPandaChain
+{
+public:
+    KinematicChainLogConstraint(unsigned int links)
     {
-        Eigen::VectorXd f(getCoDimension());
-        function(x, f);
-        return f.allFinite() && f.head(3).squaredNorm() <= tolerance1_ * tolerance1_ && f[3] * f[3] <= tolerance2_ * tolerance2_;
+        pandaJointLimits(lower_limit, upper_limit);
+        maxIterations = 100;
     }
 
-    Eigen::Matrix3d skew_symmetric(Eigen::Vector3d x) const
+    void computeResidual(const StateVector &x, ResidualVector &out) const override
     {
-        Eigen::Matrix3d result;
-        result.setZero();
-        result(0, 1) = -x[2];
-        result(0, 2) = x[1];
-        result(1, 0) = x[2];
-        result(1, 2) = -x[0];
-        result(2, 0) = -x[1];
-        result(2, 1) = x[0];
-        return result;
+        Eigen::Affine3d lt, rt;
+        endEffectorPoses(x, lt, rt);
+        residual(lt, rt, out);
     }
 
-protected:
-    double tolerance1_, tolerance2_;
+    void computeResidual(const StateVector &x, ResidualVector &f, JacobianMatrix &j) const override
+    {
+        Eigen::Affine3d lt, rt;
+        Eigen::Matrix<double, 6, 7> jaco_serve, jaco_main;
+        endEffectorPoses(x, lt, rt, jaco_serve, jaco_main);
 
-private:
-    Eigen::Matrix<double, 7, 1> q_1st, q_3rd;
-    Eigen::Matrix<double, 7, 1> qinit_serve, qinit_main;
-    Eigen::Affine3d init_serve, init_main, init, init_tr;
+        residual(lt, rt, f);
+        residualJacobian(lt, rt, jaco_serve, jaco_main, f.tail<3>(), j);
+    }
 
-    std::shared_ptr<FrankaModelUpdater> panda_arm;
-    Eigen::Matrix<double, 4, 4> init_;
+private:
+    void residual(const Eigen::Affine3d &lt, const Eigen::Affine3d &rt, ResidualVector &out) const
+    {
+        Eigen::Affine3d result = lt.inverse() * rt;
+        Eigen::AngleAxisd r_diff(init.linear().transpose() * result.linear());
 
-    Eigen::Matrix<double, 14, 1> upper_limit, lower_limit;
+        out.head<3>() = init.translation() - result.translation();
+        out.tail<3>() = r_diff.angle() * r_diff.axis();
+    }
 
-    double theta, beta1, beta2, trust_radius_min;
-    int maxIterations;
+    void residualJacobian(const Eigen::Affine3d &lt, const Eigen::Affine3d &rt,
+                          const Eigen::Matrix<double, 6, 7> &jaco_serve, const Eigen::Matrix<double, 6, 7> &jaco_main,
+                          const Eigen::Vector3d &phi, JacobianMatrix &out) const
+    {
+        Eigen::Matrix<double, 3, 7> v_serve = base_serve.linear() * jaco_serve.topRows<3>();
+        Eigen::Matrix<double, 3, 7> w_serve = base_serve.linear() * jaco_serve.bottomRows<3>();
+        Eigen::Matrix<double, 3, 7> v_main = base_main.linear() * jaco_main.topRows<3>();
+        Eigen::Matrix<double, 3, 7> w_main = base_main.linear() * jaco_main.bottomRows<3>();
+
+        // translation rows are the ones of KinematicChainConstraint
+        Eigen::Matrix3d lt_inv = lt.linear().transpose();
+        Eigen::Vector3d d = rt.translation() - lt.translation();
+        out.block<3, 7>(0, 0) = lt_inv * (v_serve - skew_symmetric(d) * w_serve);
+        out.block<3, 7>(0, 7) = -lt_inv * v_main;
+
+        // phi = log(init.R^T * result.R)  -->  dphi = Jl^-1(phi) * init.R^T * lt.R^T (w_main - w_serve)
+        Eigen::Matrix3d rot = leftJacobianInverse(phi) * init.linear().transpose() * lt_inv;
+        out.block<3, 7>(3, 0) = -rot * w_serve;
+        out.block<3, 7>(3, 7) = rot * w_main;
+    }
 
-    Eigen::Affine3d base_serve, base_main;
-    Eigen::Affine3d offset_R;
+    /* inverse of the SO(3) left jacobian, I - [phi]x / 2 + (1 / t^2 - (1 + cos t) / (2 t sin t)) [phi]x^2 */
+    static Eigen::Matrix3d leftJacobianInverse(const Eigen::Vector3d &phi)
+    {
+        const double t = phi.norm();
+        const Eigen::Matrix3d phi_x = skew_symmetric(phi);
+        const double c = (t < 1e-6) ? 1. / 12 : 1 / (t * t) - (1 + std::cos(t)) / (2 * t * std::sin(t));
+        return Eigen::Matrix3d::Identity() - 0.5 * phi_x + c * phi_x * phi_x;
+    }
 };
 
-typedef std::shared_ptr<KinematicChainConstraint> ChainConstraintPtr;
+typedef std::shared_ptr<ChainConstraint> ChainConstraintPtr;
+
+/* the closed chain constraint of one planning problem, with the chosen orientation residual */
+inline ChainConstraintPtr makeChainConstraint(unsigned int links, ORIENTATION_RESIDUAL residual = ANGLE_RESIDUAL)
+{
+    if (residual == LOG_MAP_RESIDUAL)
+        return std::make_shared<KinematicChainLogConstraint>(links);
+    return std::make_shared<KinematicChainConstraint>(links);
+}
 
 // class KinematicChainConstraint : public Constraint_new
 // {
@@ -36,9 +36,15 @@
 #include <tf/transform_datatypes.h>
 
 #include <constraint_planner/kinematics/grasping point.h>
+#include <constraint_planner/kinematics/panda_sphere_broadphase.h>
+#include <constraint_planner/base/jy_ValidityCache.h>
 // #include <constraint_planner/base/jy_ConstrainedValidStateSampler.h>
 #include <ompl/base/ConstrainedSpaceInformation.h>
 
+#include <array>
+#include <atomic>
+#include <cmath>
+#include <memory>
 #include <mutex>
 
 namespace ob = ompl::base;
@@ -176,6 +182,7 @@ public:
         current_state.update();
 
         planning_group = robot_model->getJointModelGroup(grp.planning_group);
+        cache_.reset(new jy_ValidityCache(planning_group->getVariableCount()));
 
         std::vector<double> start_values;
         start_values.resize(grp.start.size());
@@ -260,12 +267,77 @@ public:
         attached_object2.object.primitives.push_back(primitive2);
         attached_object2.object.primitive_poses.push_back(box_pose2);
         // planning_scene->processAttachedCollisionObjectMsg(attached_object2);
+        sceneChanged();
+    }
+
+    /* keep a pre-initialized copy of the scene state per thread and only set the planning group joints on it,
+       instead of copying the whole scene state (three arms, attached STEFAN mesh) for every query */
+    void setReuseRobotState(bool reuse) { reuse_robot_state_ = reuse; }
+    bool getReuseRobotState() const { return reuse_robot_state_; }
+
+    /* with a reused state, every thread checks against its own diff() of the scene : the replica shares the
+       world's shapes and meshes with the scene, but owns its collision environment and broadphase, so the sampling
+       threads and the planner never touch the same collision structures. Off, all threads check the one scene, one
+       at a time */
+    void setSceneReplicas(bool replicas) { scene_replicas_ = replicas; }
+    bool getSceneReplicas() const { return scene_replicas_; }
+
+    /* replicas made so far, one per thread per scene */
+    unsigned long getReplicaCount() const { return replicas_; }
+
+    /* settle the states far from every obstacle or deep in a box with panda_sphere_broadphase, only the others
+       go to the exact check */
+    void setBroadphase(bool broadphase) { use_broadphase_ = broadphase; }
+    bool getBroadphase() const { return use_broadphase_; }
+    panda_sphere_broadphase *getSphereBroadphase() { return broadphase_.get(); }
+
+    /* results of the joint vectors checked before, setCapacity(0) turns it off */
+    jy_ValidityCache &getValidityCache() { return *cache_; }
+
+    /* after an exact check finds a state free, measure its clearance with FCL distance queries and keep the ball of
+       joint vectors it certifies : no point of the group moves more than sum_v reach[v] |dq_v| (the broadphase's
+       joint reach), so a state closer than clearance - margin in that norm is free without a check. Each thread
+       keeps the last few balls it made. Needs the broadphase's model, off by default since a distance query costs
+       more than a collision check */
+    void setClearanceCertificates(bool certificates) { use_certificates_ = certificates; }
+    bool getClearanceCertificates() const { return use_certificates_; }
+
+    /* distance kept from the measured clearance, in meters */
+    void setCertificateMargin(double margin) { certificate_margin_ = margin; }
+    double getCertificateMargin() const { return certificate_margin_; }
+
+    /* balls made, states they settled */
+    unsigned long getCertificateCount() const { return certificates_; }
+    unsigned long getCertifiedCount() const { return certified_; }
+    void resetCertificateStats() { certificates_ = certified_ = 0; }
+
+    /* the thread states and replicas copied the scene before, they copy it again on their next query, the
+       broadphase is built again and the cached results are dropped. The scene must not change while queries run,
+       the replicas read its world */
+    void sceneChanged()
+    {
+        scene_id_ = nextSceneId()++;
+        broadphase_.reset(new panda_sphere_broadphase(*planning_scene, grp.planning_group));
+        if (!broadphase_->getJointReach(reach_))
+            reach_.clear();
+        cache_->invalidate();
     }
 
     bool isValid(const ob::State *state) const override
     {
         auto &&s = state->as<ob::ConstrainedStateSpace::StateType>()->getState()->as<KinematicChainSpace::StateType>();
-        return isValidImpl(s);
+        bool valid;
+        if (cache_->lookup(s->values, valid))
+            return valid;
+        if (use_certificates_ && certified(s->values))
+        {
+            certified_++;
+            valid = true;
+        }
+        else
+            valid = isValidImpl(s);
+        cache_->insert(s->values, valid);
+        return valid;
     }
 
     protected:
@@ -277,12 +349,39 @@ public:
         collision_detection::CollisionResult res;
         bool collision;
         res.clear();
+        if (use_broadphase_ && broadphase_)
+        {
+            BROADPHASE_RESULT early = broadphase_->classify(state->values);
+            if (early != BROADPHASE_UNCERTAIN)
+                return early == BROADPHASE_FREE;
+        }
         // {
-            // std::lock_guard<std::mutex> lg(locker_);
-            robot_state::RobotState robot_state = planning_scene->getCurrentState();
-            robot_state.setJointGroupPositions(planning_group, state->values);
-            robot_state.update();
-            collision = planning_scene->isStateColliding(robot_state, grp.planning_group);
+            // the one scene's collision environment is not thread-safe : queries without a replica take turns on it
+            std::unique_lock<std::mutex> shared_scene(locker_, std::defer_lock);
+            if (reuse_robot_state_)
+            {
+                // only the group's joints and the links below them become dirty
+                ThreadScene &local = threadScene();
+                if (!local.replica)
+                    shared_scene.lock();
+                robot_state::RobotState &robot_state = *local.state;
+                robot_state.setJointGroupPositions(planning_group, state->values);
+                robot_state.updateCollisionBodyTransforms();
+                const planning_scene::PlanningScene &scene = local.replica ? *local.replica : *planning_scene;
+                collision = scene.isStateColliding(robot_state, grp.planning_group);
+                if (!collision && use_certificates_)
+                    certify(state->values, scene, robot_state);
+            }
+            else
+            {
+                shared_scene.lock();
+                robot_state::RobotState robot_state = planning_scene->getCurrentState();
+                robot_state.setJointGroupPositions(planning_group, state->values);
+                robot_state.update();
+                collision = planning_scene->isStateColliding(robot_state, grp.planning_group);
+                if (!collision && use_certificates_)
+                    certify(state->values, *planning_scene, robot_state);
+            }
             // planning_scene->checkCollision(req, res, robot_state);
         // }
 
@@ -305,7 +404,127 @@ public:
         // }
     }
 
+    /* state (and replica) the calling thread owns, made again when they belong to another checker or scene */
+    struct ThreadScene
+    {
+        unsigned long id{0}; // scene ids start at 1, unique across checkers
+        planning_scene::PlanningScenePtr replica;
+        std::unique_ptr<robot_state::RobotState> state;
+    };
+
+    ThreadScene &threadScene() const
+    {
+        thread_local ThreadScene local;
+        const unsigned long id = scene_id_;
+        const bool replica = scene_replicas_;
+        if (local.id != id || !local.state || replica != (bool)local.replica)
+        {
+            local.replica.reset();
+            if (replica)
+            {
+                // diff() only reads the scene, the lock keeps the replicas of concurrent threads from racing anyway
+                std::lock_guard<std::mutex> lg(locker_);
+                local.replica = planning_scene->diff();
+                replicas_++;
+            }
+            local.state.reset(new robot_state::RobotState(replica ? local.replica->getCurrentState() : planning_scene->getCurrentState()));
+            local.state->update();
+            local.id = id;
+        }
+        return local;
+    }
+
+    /* free ball around center : joint vectors q with sum_v reach[v] |q_v - center_v| < radius */
+    struct Certificate
+    {
+        unsigned long id{0}; // scene, 0 for an empty slot
+        std::vector<double> center;
+        double radius{0};
+    };
+
+    enum
+    {
+        Certificates = 8 // balls a thread keeps
+    };
+
+    struct ThreadCertificates
+    {
+        std::array<Certificate, Certificates> balls;
+        unsigned int next{0};
+    };
+
+    ThreadCertificates &threadCertificates() const
+    {
+        thread_local ThreadCertificates local;
+        return local;
+    }
+
+    bool certified(const double *q) const
+    {
+        const unsigned long id = scene_id_;
+        if (reach_.empty())
+            return false;
+        for (const Certificate &ball : threadCertificates().balls)
+        {
+            if (ball.id != id)
+                continue;
+            double moved = 0;
+            for (unsigned int v = 0; v < reach_.size() && moved < ball.radius; v++)
+                moved += reach_[v] * std::abs(q[v] - ball.center[v]);
+            if (moved < ball.radius)
+                return true;
+        }
+        return false;
+    }
+
+    /* robot_state : the free state q, its collision bodies placed */
+    void certify(const double *q, const planning_scene::PlanningScene &scene, const robot_state::RobotState &robot_state) const
+    {
+        if (reach_.empty())
+            return;
+        // the pairs isStateColliding(state, group) checks : the group's links and bodies against the world and the robot
+        collision_detection::DistanceRequest req;
+        req.group_name = grp.planning_group;
+        req.enableGroup(robot_model);
+        req.acm = &scene.getAllowedCollisionMatrix();
+        req.type = collision_detection::DistanceRequestType::GLOBAL;
+        collision_detection::DistanceResult res;
+        scene.getCollisionWorld()->distanceRobot(req, res, *scene.getCollisionRobot(), robot_state);
+        double clearance = res.minimum_distance.distance;
+        res.clear();
+        scene.getCollisionRobot()->distanceSelf(req, res, robot_state);
+        clearance = std::min(clearance, res.minimum_distance.distance) - certificate_margin_;
+        if (!(clearance > 0))
+            return;
+
+        ThreadCertificates &local = threadCertificates();
+        Certificate &ball = local.balls[local.next++ % Certificates];
+        ball.id = scene_id_;
+        ball.center.assign(q, q + reach_.size());
+        ball.radius = clearance;
+        certificates_++;
+    }
+
 private:
+
+    static std::atomic<unsigned long> &nextSceneId()
+    {
+        static std::atomic<unsigned long> id{1};
+        return id;
+    }
+
+    bool reuse_robot_state_{true};
+    bool scene_replicas_{true};
+    bool use_broadphase_{true};
+    std::unique_ptr<panda_sphere_broadphase> broadphase_;
+    std::unique_ptr<jy_ValidityCache> cache_;
+    bool use_certificates_{false};
+    double certificate_margin_{0.005};
+    std::vector<double> reach_; // joint reach of the group's variables, empty without the broadphase's model
+    mutable std::atomic<unsigned long> certificates_{0}, certified_{0};
+    mutable std::atomic<unsigned long> replicas_{0};
+    std::atomic<unsigned long> scene_id_{0};
+
     robot_model::RobotModelPtr robot_model;
     std::shared_ptr<planning_scene::PlanningScene> planning_scene;
     collision_detection::AllowedCollisionMatrixPtr acm_;
@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Eigen/Dense>
+#include <vector>
+
+typedef Eigen::Matrix<double, 7, 1> Vector7d;
+
+/* Closed-form inverse kinematics of one Panda arm, panda_link0 -> panda_hand (the chain panda_ik hands to TRAC-IK).
+   The redundancy is parameterized by q7 : once q7 is fixed the wrist center is known, q4 follows from the
+   shoulder-wrist distance and the remaining swivel about the shoulder-wrist line from the q5/q6 wrist geometry.
+   That gives at most 8 solutions per q7 (2 elbow x 2 swivel x 2 shoulder). */
+class panda_analytic_ik
+{
+public:
+    panda_analytic_ik();
+
+    /* solutions outside [lower, upper] are dropped, [-pi, pi] by default : panda_ik sets the URDF limits and
+       panda_ik_pool the KinematicChainSpace bounds */
+    void setJointLimits(const Vector7d &lower, const Vector7d &upper);
+    const Vector7d &getLowerLimits() const { return lower_; }
+    const Vector7d &getUpperLimits() const { return upper_; }
+
+    /* appends every in-limit solution with the given q7 and returns how many were added */
+    unsigned int solve(const Eigen::Affine3d &target, double q7, std::vector<Vector7d> &solutions) const;
+    /* solve() for `steps` q7 values evenly spread over the q7 limits */
+    unsigned int solveSweep(const Eigen::Affine3d &target, unsigned int steps, std::vector<Vector7d> &solutions) const;
+
+    /* panda_link0 -> panda_hand, the chain solve() inverts */
+    Eigen::Affine3d forwardKinematics(const Vector7d &q) const;
+
+private:
+    /* shifts each joint by 2pi where that brings it inside the limits, false if it still does not fit */
+    bool wrapToLimits(Vector7d &q) const;
+
+    Vector7d lower_, upper_;
+};
@@ -7,8 +7,14 @@
 #include <kdl_parser/kdl_parser.hpp>
 
 #include <rbdl/rbdl.h>
+#include <constraint_planner/kinematics/panda_analytic_ik.h>
 #include <iostream>
 #include <memory>
+#include <atomic>
+#include <chrono>
+#include <mutex>
+#include <thread>
+#include <unordered_map>
 using namespace Eigen;
 using namespace RigidBodyDynamics;
 typedef Eigen::Matrix<double, 7, 1> Vector7d;
@@ -16,17 +22,37 @@ typedef Eigen::Matrix<double, 6, 1> Vector6d;
 
 #define deg2rad(ang) ((ang)*M_PI / 180.0)
 #define rad2deg(ang) ((ang)*180 / M_PI)
+
+/* which implementation FrankaModelUpdater::getTransform uses */
+enum KINEMATICS_BACKEND
+{
+    RBDL_KINEMATICS,       // UpdateKinematicsCustom + CalcBodyToBaseCoordinates on the shared RBDL model
+    CLOSED_FORM_KINEMATICS // fixed-size product of the 7 joint transforms, no heap work
+};
+
+/* All kinematics / dynamics queries are const and reentrant : the RBDL description is never updated after
+   construction, and each thread runs RBDL on its own copy of it (see workspace()). The copies belong to the
+   model and go away with it. */
 class FrankaModelUpdater
 {
 public:
-    FrankaModelUpdater();
+    FrankaModelUpdater(KINEMATICS_BACKEND backend = CLOSED_FORM_KINEMATICS);
     void PandaRBDLModel();
-    Affine3d getTransform(const Vector7d &q);
-    Matrix<double, 6, 7> getJacobian(const Vector7d &q);
-    Matrix<double, 7, 7> getMassMatrix(const Vector7d &q);
-    Matrix<double, 7, 1> getGravity(const Vector7d &q);
-    
-    std::shared_ptr<Model> rbdl_model_;
+    Affine3d getTransform(const Vector7d &q) const;
+    /* closed-form forward kinematics with the same joint axes and offsets as PandaRBDLModel() */
+    Isometry3d forwardKinematics(const Vector7d &q) const;
+    /* largest position / rotation deviation of forwardKinematics() from the RBDL model at q, see the model updater test */
+    double checkForwardKinematics(const Vector7d &q) const;
+    void setBackend(KINEMATICS_BACKEND backend) { backend_ = backend; }
+    KINEMATICS_BACKEND getBackend() const { return backend_; }
+    Matrix<double, 6, 7> getJacobian(const Vector7d &q) const;
+    /* getTransform() and getJacobian() from a single kinematics pass */
+    void getTransformAndJacobian(const Vector7d &q, Affine3d &transform, Matrix<double, 6, 7> &jacobian) const;
+    Matrix<double, 7, 7> getMassMatrix(const Vector7d &q) const;
+    Matrix<double, 7, 1> getGravity(const Vector7d &q) const;
+
+    /* immutable model description, RBDL calls run on workspace() */
+    std::shared_ptr<const Model> rbdl_model_;
 
     // for robot model construction
     Model model_;
@@ -34,6 +60,9 @@ public:
     Math::Vector3d com_position_[7];
     Math::Matrix3d inertia_[7];
     Vector3d joint_position_[7];
+    Vector3d axis_[7];
+    Matrix3d body_to_ee_rotation_;
+    KINEMATICS_BACKEND backend_;
     Body body_[7];
     Joint joint_[7];
 
@@ -56,21 +85,95 @@ public:
     // -- arm parameters
 
     double delta_tau_max_{0.05};
+
+private:
+    Affine3d getTransformRBDL(const Vector7d &q) const;
+    /* this thread's scratch copy of rbdl_model_, created on first use */
+    Model &workspace() const;
+
+    unsigned long id_; ///< unique over the process lifetime, tells a thread's last workspace apart
+    mutable std::mutex workspaces_mutex_;
+    mutable std::unordered_map<std::thread::id, std::unique_ptr<Model>> workspaces_;
 };
 
 class panda_ik
 {
 public:
+    /* parses /single_robot_description to build the chain, prefer panda_ik_pool::get() */
     panda_ik();
+    /* builds the solver on an already parsed chain and joint limits */
+    panda_ik(const KDL::Chain &chain, const KDL::JntArray &lower, const KDL::JntArray &upper);
+    /* closed-form solution closest to start, at the first q7 of a sweep from a random phase that has one, TRAC-IK
+       seeded with start if none has. q7 is not taken from start, so repeated solves from one start reach the
+       whole redundancy */
     bool solve(VectorXd start, Affine3d target, Eigen::Ref<Eigen::VectorXd> solution);
     Eigen::VectorXd getRandomConfig();
     bool randomSolve(Affine3d target, Eigen::Ref<Eigen::VectorXd> solution);
+    /* every closed-form solution for `steps` q7 values over the q7 range */
+    unsigned int solveAll(const Affine3d &target, unsigned int steps, std::vector<Vector7d> &solutions) const;
+
+    /* TRAC-IK only when false */
+    void setUseAnalytic(bool use_analytic) { use_analytic_ = use_analytic; }
+    bool getUseAnalytic() const { return use_analytic_; }
+    /* narrows the limits closed-form solutions are filtered with, the URDF limits by default */
+    void setJointLimits(const Vector7d &lower, const Vector7d &upper);
+
+    const KDL::Chain &getChain() const { return chain; }
+    void getLimits(KDL::JntArray &lower, KDL::JntArray &upper) const;
+
+    /* solve() timing of this solver, in seconds, panda_ik_pool sums them over the pooled solvers */
+    double getLastSolveTime() const { return last_solve_time_; }
+    double getTotalSolveTime() const { return total_solve_time_; }
+    unsigned long getSolveCount() const { return solve_count_; }
 
 private:
+    friend class panda_ik_pool;
+
+    void setLimits(const KDL::JntArray &lower, const KDL::JntArray &upper);
+    void recordSolve(std::chrono::steady_clock::time_point start);
+    bool analyticSolve(const VectorXd &start, const Affine3d &target, Eigen::Ref<Eigen::VectorXd> solution);
+
     std::string chain_start{"panda_link0"};
     std::string chain_end{"panda_hand"};
     TRAC_IK::TRAC_IK tracik_solver;
     KDL::Chain chain;
     Eigen::VectorXd lb_, ub_;
     Eigen::VectorXd length;
+
+    panda_analytic_ik analytic_solver;
+    std::vector<Vector7d> analytic_solutions;
+    bool use_analytic_{true};
+
+    double last_solve_time_{0.};
+    double total_solve_time_{0.};
+    unsigned long solve_count_{0};
+    bool pooled_{false}; ///< handed out by panda_ik_pool, its solves count in the pool totals
+};
+
+/* One panda_ik per thread, kept for the lifetime of the thread so it is reused across goal samples
+   and planning queries. The KDL chain and limits are parsed from the robot description only once
+   per process; every other solver is built directly on that chain. */
+class panda_ik_pool
+{
+public:
+    static panda_ik &get();
+    /* limits every pooled solver filters closed-form solutions with, e.g. the KinematicChainSpace bounds of one arm */
+    static void setJointLimits(const Vector7d &lower, const Vector7d &upper);
+
+    /* solve() calls of every pooled solver, over all threads, and the seconds they took */
+    static unsigned long getSolveCount() { return solves_; }
+    static double getTotalSolveTime() { return 1e-9 * solve_nanoseconds_; }
+    static void resetStats();
+
+private:
+    friend class panda_ik;
+
+    static std::atomic<unsigned long> solves_, solve_nanoseconds_;
+
+    static std::once_flag parsed_;
+    static std::unique_ptr<panda_ik> prototype_;
+
+    static std::mutex limits_mutex_;
+    static Vector7d lower_, upper_;
+    static std::atomic<unsigned int> limits_version_; ///< 0 until setJointLimits() is called
 };
\ No newline at end of file
@@ -0,0 +1,147 @@
+#pragma once
+
+#include <moveit/planning_scene/planning_scene.h>
+#include <moveit/robot_state/robot_state.h>
+#include <geometric_shapes/shapes.h>
+#include <eigen_stl_containers/eigen_stl_vector_container.h>
+
+#include <Eigen/Dense>
+#include <Eigen/Geometry>
+
+#include <atomic>
+#include <string>
+#include <vector>
+
+/* answer of panda_sphere_broadphase::classify() */
+enum BROADPHASE_RESULT
+{
+    BROADPHASE_FREE,      // no pair MoveIt checks can touch, the exact check would say free
+    BROADPHASE_COLLIDING, // a surface point of a moving body is inside an obstacle box, the exact check would say colliding
+    BROADPHASE_UNCERTAIN  // only the exact check can tell
+};
+
+struct BroadphaseStats
+{
+    unsigned long free;
+    unsigned long colliding;
+    unsigned long uncertain;
+};
+
+/* Conservative pre-check of PlanningScene::isStateColliding(state, group). Built from a scene once :
+   - every body with collision geometry (links, attached objects, world objects) whose pose depends on the group's
+     joints is covered by spheres fitted to its (padded) surface, and keeps a few of its surface points as witnesses,
+   - the other bodies are obstacles, boxes stay exact boxes, any other shape is covered by spheres,
+   - the pairs MoveIt would check are kept, the ones the allowed collision matrix or the touch links allow are not.
+   classify() places the spheres with a closed-form product of the group's joint transforms (the URDF joint origins
+   and axes, checked against MoveIt at construction) and tests them on structure of arrays blocks with Eigen array
+   expressions. A witness deeper than the margin inside an obstacle box proves a collision, spheres further than the
+   margin from every checked body prove there is none, everything in between is left to the exact check. */
+class panda_sphere_broadphase
+{
+public:
+    /* spacing : max distance between two surface samples, added to every sphere radius.
+       max_radius, max_spheres : a body's spheres are split until they are smaller or there are that many */
+    panda_sphere_broadphase(const planning_scene::PlanningScene &scene, const std::string &group,
+                            double spacing = 0.01, double max_radius = 0.05, unsigned int max_spheres = 32);
+
+    /* false when the group is not a set of revolute joints or its transforms disagree with MoveIt,
+       classify() then always answers BROADPHASE_UNCERTAIN */
+    bool isReady() const { return ready_; }
+
+    /* width of the uncertain band around the obstacles, in meters */
+    void setMargin(double margin) { margin_ = margin; }
+    double getMargin() const { return margin_; }
+
+    /* q : the group's joint values, in the order of JointModelGroup::getVariableNames() */
+    BROADPHASE_RESULT classify(const double *q) const;
+
+    std::size_t getSphereCount() const { return radii_.size(); }
+    std::size_t getPairCount() const { return obstacle_pairs_.size() + moving_pairs_.size(); }
+
+    /* reach[v] : bound on the distance from the axis of group variable v of every point of the bodies it moves, for
+       any value of the other joints. Between two states no point of the group moves more than
+       sum_v reach[v] |dq_v|. False when the broadphase is not ready */
+    bool getJointReach(std::vector<double> &reach) const;
+
+    BroadphaseStats getStats() const;
+    void resetStats();
+
+    /* the group's link poses classify() computes, for the construction check */
+    void forwardKinematics(const double *q, EigenSTL::vector_Isometry3d &poses) const;
+
+    /* outer spheres of surface points no further than gap from the surface they sample : leaves of a split at the
+       median of the widest axis, until every leaf's sphere is under max_radius or there are max_spheres leaves.
+       witnesses : the extreme points of every leaf along the 6 axis directions */
+    static void fitSpheres(const std::vector<Eigen::Vector3d> &points, double gap, double max_radius,
+                           unsigned int max_spheres, Eigen::Matrix3Xd &centers, Eigen::VectorXd &radii,
+                           Eigen::Matrix3Xd &witnesses);
+
+    /* points on the surface (or inside) of a shape in its own frame, every surface point within spacing of one */
+    static void sampleShape(const shapes::Shape &shape, double spacing, std::vector<Eigen::Vector3d> &points);
+
+private:
+    /* transform of group joint i : pose of its child link = pose of frame parent * offset * rotation(axis, q) */
+    struct Frame
+    {
+        int parent; // -1 : offset is the world pose of the joint's parent link
+        unsigned int variable;
+        Eigen::Isometry3d offset;
+        Eigen::Vector3d axis;
+
+        EIGEN_MAKE_ALIGNED_OPERATOR_NEW
+    };
+
+    struct Body
+    {
+        std::string name;
+        int frame;               // -1 for an obstacle
+        unsigned int begin, end; // spheres
+        unsigned int witness_begin, witness_end;
+        Eigen::Vector3d bound_center; // in the frame (world for obstacles), encloses the body
+        double bound_radius;
+    };
+
+    struct Box
+    {
+        unsigned int body;
+        Eigen::Matrix3d rotation;
+        Eigen::Vector3d center, half;
+    };
+
+    struct Pair
+    {
+        unsigned int moving, other;
+        bool witness; // an allowed-if-conditional pair proves nothing
+    };
+
+    /* shapes are scaled and padded like the collision environment does, poses are in the frame (world for -1) */
+    bool addBody(const std::string &name, int frame, double scale, double padding,
+                 const std::vector<shapes::ShapeConstPtr> &shapes, const EigenSTL::vector_Isometry3d &poses);
+    int frameOf(const robot_model::LinkModel *link) const;
+
+    /* bound_b : b's bounding sphere center, a's spheres out of it skip b's spheres */
+    bool spheresApart(unsigned int a, const Eigen::Matrix3Xd &ca, unsigned int b, const Eigen::Matrix3Xd &cb,
+                      const Eigen::Vector3d &bound_b) const;
+    bool spheresApart(unsigned int a, const Eigen::Matrix3Xd &ca, const Box &box) const;
+
+    bool ready_{false};
+    double spacing_, max_radius_;
+    unsigned int max_spheres_;
+    double margin_{0.005};
+    bool constant_collision_{false}; // two bodies on the same frame collide, every state does
+
+    std::vector<Frame, Eigen::aligned_allocator<Frame>> frames_;
+    std::vector<const robot_model::JointModel *> joints_;
+
+    std::vector<Body> bodies_;
+    Eigen::Matrix3Xd centers_; // in the body's frame, world for obstacles
+    Eigen::VectorXd radii_;
+    Eigen::Matrix3Xd witnesses_;
+    std::vector<Box> boxes_;
+    std::vector<std::vector<unsigned int>> body_boxes_;
+
+    std::vector<Pair> obstacle_pairs_; // moving body, obstacle
+    std::vector<Pair> moving_pairs_;   // moving body, moving body on another frame
+
+    mutable std::atomic<unsigned long> free_{0}, colliding_{0}, uncertain_{0};
+};
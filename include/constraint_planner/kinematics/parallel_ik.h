@@ -0,0 +1,81 @@
+#pragma once
+
+#include <constraint_planner/kinematics/panda_model_updater.h>
+
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/* Dual-arm IK from K random seeds at once. A persistent pool of workers pulls seeds, each worker solving the
+   serve and main arm with its own panda_ik from panda_ik_pool. With FIRST_ACCEPTED the first pair accepted by the
+   validity callback cancels the other seeds and is returned (first-wins), with a ranking all K seeds run and the
+   best accepted pair is returned. The validity callback is called from every worker at once. */
+class parallel_ik
+{
+public:
+    /* how accepted pairs are ranked */
+    enum SCORE
+    {
+        FIRST_ACCEPTED, // no ranking, the first accepted pair cancels the other seeds
+        MANIPULABILITY, // the smaller of the two arms' sqrt(det(J J^T)), larger is better
+        START_DISTANCE  // closest to the given 14 dof start configuration
+    };
+    typedef std::function<bool(const Eigen::VectorXd &)> ValidityCheckerFn;
+
+    /* threads = 0 uses one worker per hardware thread */
+    parallel_ik(unsigned int threads = 0);
+    ~parallel_ik();
+
+    /* process-wide instance shared by the goal samplers */
+    static parallel_ik &get();
+
+    /* solution (14) = serve (0~6) + main (7~13) joints, false when none of the seeds gave a valid pair */
+    bool solve(const Affine3d &target_serve, const Affine3d &target_main, unsigned int seeds,
+               const ValidityCheckerFn &is_valid, Eigen::Ref<Eigen::VectorXd> solution,
+               SCORE score = FIRST_ACCEPTED, const Eigen::VectorXd &start = Eigen::VectorXd());
+
+    unsigned int getThreadCount() const { return workers_.size(); }
+    /* seeds the last solve() ran and skipped after cancellation */
+    unsigned int getLastSeedsRun() const { return seeds_run_; }
+    unsigned int getLastSeedsCancelled() const { return seeds_cancelled_; }
+
+private:
+    struct Batch
+    {
+        Affine3d target_serve, target_main;
+        unsigned int seeds;
+        const ValidityCheckerFn *is_valid;
+        SCORE score;
+        Eigen::VectorXd start;
+
+        std::atomic<unsigned int> next_seed{0};
+        std::atomic<unsigned int> run{0};
+        std::atomic<bool> cancelled{false};
+
+        std::mutex best_mutex;
+        bool found{false};
+        double best_score;
+        Eigen::VectorXd best;
+    };
+
+    void work();
+    void runSeed(Batch &batch);
+    double scorePair(const Batch &batch, const Eigen::VectorXd &q) const;
+
+    std::vector<std::thread> workers_;
+    FrankaModelUpdater panda_arm_;
+
+    std::mutex solve_mutex_; ///< one batch at a time
+    std::mutex pool_mutex_;
+    std::condition_variable work_cv_, done_cv_;
+    Batch *batch_{nullptr};
+    unsigned long generation_{0};
+    unsigned int busy_{0};
+    bool shutdown_{false};
+
+    unsigned int seeds_run_{0};
+    unsigned int seeds_cancelled_{0};
+};
@@ -1,89 +1,83 @@
 #pragma once
 
-#include <ompl/base/MotionValidator.h>
-#include <ompl/base/PlannerData.h>
 #include <ompl/base/StateSampler.h>
-#include <ompl/base/ValidStateSampler.h>
-#include <ompl/base/Constraint.h>
 #include <ompl/base/spaces/RealVectorStateSpace.h>
-#include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
+#include <ompl/util/ClassForward.h>
 
-#include <Eigen/Core>
+#include <atomic>
+#include <cstdint>
+#include <vector>
 
 namespace ompl
 {
     namespace base
     {
         /// @cond IGNORE
-        /** \brief Forward declaration of ompl::base::NoRandomSampleSpace */
-        OMPL_CLASS_FORWARD(NoRandomSampleSpace);
+        /** \brief Forward declaration of ompl::base::HaltonSequence */
+        OMPL_CLASS_FORWARD(HaltonSequence);
         /// @endcond
 
-        /** \brief StateSampler for use for a projection-based state space. */
-        class NoRandomSampler : public WrapperStateSampler
+        /** \brief Scrambled Halton sequence in the unit cube. Dimension i is the radical inverse in the i-th prime
+         * with a random permutation of the nonzero digits (Faure-Lemieux style), which breaks the correlation
+         * between the high prime dimensions the plain sequence shows. One sequence is shared by the samplers of
+         * all threads : each sampler claims blocks of consecutive indices, so together they consume a single
+         * prefix of the sequence instead of overlapping copies of it. */
+        class HaltonSequence
         {
         public:
-            /** \brief Constructor. */
-            NoRandomSampler(const NoRandomSampleSpace *space, StateSamplerPtr sampler);
+            /** \brief The permutations are drawn from ompl::RNG, so they follow RNG::setSeed(). */
+            HaltonSequence(unsigned int dimension);
 
-            /** \brief Sample a state uniformly in ambient space and project to
-             * the manifold. Return sample in \a state. */
-            void sampleUniform(State *state) override;
+            unsigned int getDimension() const
+            {
+                return bases_.size();
+            }
 
-            /** \brief Sample a state uniformly from the ball with center \a
-             * near and radius \a distance in ambient space and project to the
-             * manifold. Return sample in \a state. */
-            void sampleUniformNear(State *state, const State *near, double distance) override;
+            /** \brief Index of the first of \e size indices no other caller gets. */
+            std::uint64_t claimBlock(unsigned int size);
 
-            /** \brief Sample a state uniformly from a normal distribution with
-                given \a mean and \a stdDev in ambient space and project to the
-                manifold. Return sample in \a state. */
-            void sampleGaussian(State *state, const State *mean, double stdDev) override;
+            /** \brief Indices handed out so far. */
+            std::uint64_t getClaimedCount() const
+            {
+                return next_ - 1;
+            }
 
-        protected:
-            /** \brief Constraint. */
-            const ConstraintPtr constraint_;
-        };
+            /** \brief Point \e index of the sequence, coordinates in [0, 1). */
+            void point(std::uint64_t index, double *out) const;
 
+        private:
+            std::vector<unsigned int> bases_;
+            std::vector<std::vector<unsigned int>> permutations_;
 
-        /** \brief ConstrainedStateSpace encapsulating a projection-based
-         * methodology for planning with constraints. */
-        class NoRandomSampleSpace : public ConstrainedStateSpace
+            /** \brief Index 0 is the origin for every permutation, the sequence starts at 1. */
+            std::atomic<std::uint64_t> next_{1};
+        };
+
+        /** \brief Quasi-random sampler of a RealVectorStateSpace : uniform samples are the points of a shared
+         * HaltonSequence scaled to the bounds. Near and gaussian samples are local and stay pseudo-random. Used as
+         * the ambient sampler of jy_ProjectedStateSpace, which projects its samples onto the manifold. */
+        class NoRandomSampler : public StateSampler
         {
         public:
-            /** \brief Construct an atlas with the specified dimensions. */
-            NoRandomSampleSpace(const StateSpacePtr &ambientSpace, const ConstraintPtr &constraint)
-              : ConstrainedStateSpace(ambientSpace, constraint)
-            {
-                setName("Projected" + space_->getName());
-            }
+            /** \brief \e blockSize indices are claimed from \e sequence at a time, smaller blocks keep the points
+             * of concurrent samplers closer to one prefix. */
+            NoRandomSampler(const StateSpace *space, HaltonSequencePtr sequence, unsigned int blockSize = 256);
 
-            /** \brief Destructor. */
-            ~NoRandomSampleSpace() override = default;
+            void sampleUniform(State *state) override;
 
-            /** \brief Allocate the default state sampler for this space. */
-            StateSamplerPtr allocDefaultStateSampler() const override
-            {
-                return std::make_shared<NoRandomSampler>(this, space_->allocDefaultStateSampler());
-            }
+            void sampleUniformNear(State *state, const State *near, double distance) override;
 
-            /** \brief Allocate the previously set state sampler for this space. */
-            StateSamplerPtr allocStateSampler() const override
-            {
-                return std::make_shared<NoRandomSampler>(this, space_->allocStateSampler());
-            }
+            void sampleGaussian(State *state, const State *mean, double stdDev) override;
+
+        protected:
+            HaltonSequencePtr sequence_;
+
+            /** \brief Default sampler of the space for the local samples. */
+            StateSamplerPtr random_;
 
-            /** \brief Traverse the manifold from \a from toward \a to. Returns
-             * true if we reached \a to, and false if we stopped early for any
-             * reason, such as a collision or traveling too far. No collision
-             * checking is performed if \a interpolate is true. If \a geodesic
-             * is not nullptr, the sequence of intermediates is saved to it,
-             * including a copy of \a from, as well as the final state, which is
-             * a copy of \a to if we reached \a to. Caller is responsible for
-             * freeing states returned in \a geodesic.*/
-            
-            bool discreteGeodesic(const State *from, const State *to, bool interpolate = false,
-                                  std::vector<State *> *geodesic = nullptr) const override;
+            unsigned int blockSize_;
+            std::uint64_t next_{0}, end_{0};
+            std::vector<double> point_;
         };
     }
 }
@@ -11,10 +11,13 @@
 #include <map>
 
 #include <constraint_planner/kinematics/panda_model_updater.h>
+#include <constraint_planner/kinematics/parallel_ik.h>
 #include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
 
 #include <ompl/base/ConstrainedSpaceInformation.h>
 #include <constraint_planner/kinematics/KinematicChain.h>
+#include <constraint_planner/base/jy_NearestNeighborsSoA.h>
+#include <constraint_planner/base/jy_ConstrainedValidStateSampler.h>
 
 #include <ompl/base/goals/GoalState.h>
 
@@ -187,6 +190,27 @@ namespace ompl
             }
             bool isSatisfied(const ob::State *st) const;
             bool sampleIKgoal(ob::State *result);
+
+            /** \brief Number of random IK seeds sampleIKgoal() tries in parallel per object pose */
+            void setIKSeeds(unsigned int seeds)
+            {
+                ikSeeds_ = seeds;
+            }
+            unsigned int getIKSeeds() const
+            {
+                return ikSeeds_;
+            }
+
+            /** \brief Radius of the steps of the expansion's bouncing motion, each one a sampleUniformNear() around the
+                previous state. 0 bounces to uniform samples of the whole space (SpaceInformation::randomBounceMotion) */
+            void setBounceDistance(double distance)
+            {
+                bounceDistance_ = distance;
+            }
+            double getBounceDistance() const
+            {
+                return bounceDistance_;
+            }
             // bool sampleIKgoal(Eigen::Ref<Eigen::VectorXd> goal);
 
         protected:
@@ -217,6 +241,9 @@ namespace ompl
                 expansion step) */
             void expandRoadmap(const base::PlannerTerminationCondition &ptc, std::vector<base::State *> &workStates);
 
+            /** \brief randomBounceMotion() with steps sampled near the previous state instead of anywhere */
+            unsigned int localBounceMotion(const base::State *start, std::vector<base::State *> &states) const;
+
             /** Thread that checks for solution */
             void checkForSolution(const base::PlannerTerminationCondition &ptc, base::PathPtr &solution);
             void updateStart(const base::PlannerTerminationCondition &ptc);
@@ -267,6 +294,15 @@ namespace ompl
             {
                 return std::to_string(edgeCount());
             }
+            /* acceptance rate or mean seconds per test of one valid sampler stage, 0 before the first sample */
+            std::string getSamplerStageString(SAMPLER_STAGE stage, bool time) const
+            {
+                auto sampler = std::dynamic_pointer_cast<jy_ConstrainedValidStateSampler>(sampler_);
+                if (!sampler)
+                    return std::to_string(0.);
+                SamplerStageStats stats = sampler->getStageStats(stage);
+                return std::to_string(time ? stats.time : stats.acceptance);
+            }
 
             /** \brief Flag indicating whether the default connection strategy is the Star strategy */
             bool starStrategy_;
@@ -344,7 +380,10 @@ namespace ompl
 
             grasping_point grp;
             std::shared_ptr<FrankaModelUpdater> panda_arm;
-            std::shared_ptr<panda_ik> panda_ik_solver;
+            unsigned int ikSeeds_{48};
+
+            /** \brief Step radius of the expansion's bouncing motion, 0 for uniform bounces */
+            double bounceDistance_{0.};
         };
     }
 }
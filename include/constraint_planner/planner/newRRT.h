@@ -8,6 +8,7 @@
 #include <ompl/base/goals/GoalState.h>
 #include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
 #include <constraint_planner/kinematics/KinematicChain.h>
+#include <constraint_planner/base/jy_NearestNeighborsSoA.h>
 
 #include <constraint_planner/kinematics/panda_model_updater.h>
 namespace ompl
@@ -5,6 +5,7 @@
 
 #include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
 #include <constraint_planner/kinematics/KinematicChain.h>
+#include <constraint_planner/base/jy_NearestNeighborsSoA.h>
 #include <constraint_planner/kinematics/panda_model_updater.h>
 
 namespace ob = ompl::base;
@@ -0,0 +1,141 @@
+#include <constraint_planner/base/jy_ConstrainedValidStateSampler.h>
+
+#include <algorithm>
+#include <chrono>
+#include <limits>
+
+jy_ConstrainedValidStateSampler::jy_ConstrainedValidStateSampler(const ob::SpaceInformation *si,
+                                                                 jy_SampleProducerPtr producer)
+  : ob::ConstrainedValidStateSampler(si)
+  , sampler_(si->getStateSpace()->allocStateSampler())
+  , constraint_(si->getStateSpace()->as<ompl::base::ConstrainedStateSpace>()->getConstraint())
+  , producer_(std::move(producer))
+{
+    attempts_ = 50;
+    // the joint limits are the bounds of the ambient KinematicChainSpace
+    const ob::RealVectorBounds &bounds =
+        si->getStateSpace()->as<ob::ConstrainedStateSpace>()->getSpace()->as<ob::RealVectorStateSpace>()->getBounds();
+    lower_limit = Eigen::Map<const Eigen::Matrix<double, 14, 1>>(bounds.low.data());
+    upper_limit = Eigen::Map<const Eigen::Matrix<double, 14, 1>>(bounds.high.data());
+}
+
+bool jy_ConstrainedValidStateSampler::sample(ob::State *state)
+{
+    if (producer_ && producer_->pop(state))
+        return true;
+
+    for (unsigned int tries = 0; tries < attempts_; tries++)
+    {
+        sampler_->sampleUniform(state);
+        if (reorder_interval_ > 0 && ++samples_ % reorder_interval_ == 0)
+            reorderStages();
+
+        bool valid = true;
+        for (SAMPLER_STAGE stage : order_)
+        {
+            if (!(valid = runStage(stage, state)))
+                break;
+        }
+        if (valid)
+            return true;
+    }
+    return false;
+}
+
+bool jy_ConstrainedValidStateSampler::runStage(SAMPLER_STAGE stage, ob::State *state)
+{
+    const auto start = std::chrono::steady_clock::now();
+    bool passed;
+    switch (stage)
+    {
+    case BOUNDS_STAGE:
+        passed = testBounds(state);
+        break;
+    case CONSTRAINT_STAGE:
+        passed = constraint_->isSatisfied(state);
+        break;
+    default:
+        passed = si_->isValid(state);
+        break;
+    }
+    const auto elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start);
+
+    StageCounters &counters = counters_[stage];
+    counters.tested.fetch_add(1, std::memory_order_relaxed);
+    counters.nanoseconds.fetch_add(elapsed.count(), std::memory_order_relaxed);
+    if (passed)
+        counters.passed.fetch_add(1, std::memory_order_relaxed);
+    return passed;
+}
+
+bool jy_ConstrainedValidStateSampler::testBounds(ob::State *state) const
+{
+    auto &&rstate = state->as<ob::ConstrainedStateSpace::StateType>()->getState()->as<KinematicChainSpace::StateType>();
+    for (unsigned int i = 0; i < 14; ++i)
+    {
+        if (rstate->values[i] > upper_limit[i] || rstate->values[i] < lower_limit[i])
+            return false;
+    }
+    return true;
+}
+
+void jy_ConstrainedValidStateSampler::reorderStages()
+{
+    const unsigned long min_tests = 16; // every stage needs this many before its rates mean anything
+
+    std::array<double, SAMPLER_STAGES> cost;
+    for (SAMPLER_STAGE stage : order_)
+    {
+        SamplerStageStats stats = getStageStats(stage);
+        if (stats.tested < min_tests)
+            return;
+        // time spent per rejected sample, a stage that never rejects only costs
+        cost[stage] = stats.acceptance < 1 ? stats.time / (1 - stats.acceptance) : std::numeric_limits<double>::infinity();
+    }
+    std::stable_sort(order_.begin(), order_.end(),
+                     [&cost](SAMPLER_STAGE a, SAMPLER_STAGE b) { return cost[a] < cost[b]; });
+}
+
+void jy_ConstrainedValidStateSampler::setStageOrder(const std::vector<SAMPLER_STAGE> &order)
+{
+    std::vector<SAMPLER_STAGE> sorted(order);
+    std::sort(sorted.begin(), sorted.end());
+    if (sorted != std::vector<SAMPLER_STAGE>{BOUNDS_STAGE, CONSTRAINT_STAGE, COLLISION_STAGE})
+        throw ompl::Exception("jy_ConstrainedValidStateSampler::setStageOrder(): every stage must appear once.");
+    order_ = order;
+    reorder_interval_ = 0;
+}
+
+SamplerStageStats jy_ConstrainedValidStateSampler::getStageStats(SAMPLER_STAGE stage) const
+{
+    const StageCounters &counters = counters_[stage];
+    const unsigned long tested = counters.tested.load(std::memory_order_relaxed);
+    const unsigned long passed = counters.passed.load(std::memory_order_relaxed);
+    const double seconds = counters.nanoseconds.load(std::memory_order_relaxed) * 1e-9;
+    return {tested, passed, tested > 0 ? (double)passed / tested : 0., tested > 0 ? seconds / tested : 0.};
+}
+
+void jy_ConstrainedValidStateSampler::resetStageStats()
+{
+    for (StageCounters &counters : counters_)
+    {
+        counters.tested = 0;
+        counters.passed = 0;
+        counters.nanoseconds = 0;
+    }
+}
+
+const char *jy_ConstrainedValidStateSampler::getStageName(SAMPLER_STAGE stage)
+{
+    switch (stage)
+    {
+    case BOUNDS_STAGE:
+        return "bounds";
+    case CONSTRAINT_STAGE:
+        return "constraint";
+    case COLLISION_STAGE:
+        return "collision";
+    default:
+        return "unknown";
+    }
+}
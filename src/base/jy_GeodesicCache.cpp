@@ -0,0 +1,181 @@
+#include <constraint_planner/base/jy_GeodesicCache.h>
+
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+
+jy_GeodesicCache::jy_GeodesicCache(const ob::ConstrainedStateSpace *space, std::size_t capacity)
+  : space_(space), capacity_(capacity)
+{
+}
+
+jy_GeodesicCache::~jy_GeodesicCache()
+{
+    clear();
+}
+
+void jy_GeodesicCache::setCapacity(std::size_t capacity)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    capacity_ = capacity;
+    while (entries_.size() > capacity_)
+    {
+        erase(std::prev(entries_.end()));
+        evictions_++;
+    }
+}
+
+std::size_t jy_GeodesicCache::key(const ob::State *from, const ob::State *to) const
+{
+    // FNV-1a over the bits of the coordinates of both states
+    std::uint64_t hash = 14695981039346656037ULL;
+    for (const ob::State *state : {from, to})
+    {
+        const double *x = state->as<ob::ConstrainedStateSpace::StateType>()->data();
+        for (unsigned int i = 0; i < space_->getAmbientDimension(); i++)
+        {
+            std::uint64_t bits;
+            std::memcpy(&bits, &x[i], sizeof(bits));
+            hash = (hash ^ bits) * 1099511628211ULL;
+        }
+    }
+    return hash;
+}
+
+bool jy_GeodesicCache::equal(const ob::State *a, const ob::State *b) const
+{
+    return *a->as<ob::ConstrainedStateSpace::StateType>() == *b->as<ob::ConstrainedStateSpace::StateType>();
+}
+
+jy_GeodesicCache::Entry *jy_GeodesicCache::find(std::size_t key, const ob::State *from, const ob::State *to)
+{
+    auto it = index_.find(key);
+    if (it == index_.end())
+        return nullptr;
+
+    auto entry = it->second;
+    if (!equal(entry->from, from) || !equal(entry->to, to))
+    {
+        erase(entry); // another pair with the same hash, the new one takes its place
+        return nullptr;
+    }
+    entries_.splice(entries_.begin(), entries_, entry);
+    return &*entry;
+}
+
+bool jy_GeodesicCache::lookup(const ob::State *from, const ob::State *to, bool interpolate,
+                              std::vector<ob::State *> *geodesic, bool &result)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    lookups_++;
+    Entry *entry = find(key(from, to), from, to);
+    if (entry == nullptr)
+        return false;
+
+    const int known = interpolate ? entry->reached : entry->valid;
+    if (known < 0)
+        return false;
+    if (geodesic != nullptr)
+    {
+        // a walk that stopped early was not kept, its partial states are not known here
+        if (known == 0 || entry->states.empty())
+            return false;
+        geodesic->clear();
+        for (const ob::State *state : entry->states)
+            geodesic->push_back(space_->cloneState(state));
+    }
+
+    hits_++;
+    result = known == 1;
+    return true;
+}
+
+void jy_GeodesicCache::insert(const ob::State *from, const ob::State *to, bool interpolate, bool result,
+                              std::vector<ob::State *> *owned, const std::vector<ob::State *> *copied)
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (capacity_ == 0)
+    {
+        if (owned != nullptr)
+            freeStates(*owned);
+        return;
+    }
+
+    const std::size_t k = key(from, to);
+    Entry *entry = find(k, from, to);
+    if (entry == nullptr)
+    {
+        while (entries_.size() >= capacity_)
+        {
+            erase(std::prev(entries_.end()));
+            evictions_++;
+        }
+        entries_.emplace_front();
+        entry = &entries_.front();
+        entry->key = k;
+        entry->from = space_->cloneState(from);
+        entry->to = space_->cloneState(to);
+        index_[entry->key] = entries_.begin();
+    }
+
+    if (interpolate)
+    {
+        entry->reached = result;
+        if (!result)
+            entry->valid = 0; // collision checks only stop the walk earlier
+    }
+    else
+    {
+        entry->valid = result;
+        if (result)
+            entry->reached = 1;
+    }
+
+    const bool keep = result && store_geodesics_ && entry->states.empty();
+    if (owned != nullptr)
+    {
+        if (keep)
+            entry->states.swap(*owned);
+        freeStates(*owned);
+    }
+    else if (keep && copied != nullptr)
+    {
+        for (const ob::State *state : *copied)
+            entry->states.push_back(space_->cloneState(state));
+    }
+}
+
+void jy_GeodesicCache::erase(std::list<Entry>::iterator entry)
+{
+    space_->freeState(entry->from);
+    space_->freeState(entry->to);
+    freeStates(entry->states);
+    index_.erase(entry->key);
+    entries_.erase(entry);
+}
+
+void jy_GeodesicCache::freeStates(std::vector<ob::State *> &states) const
+{
+    for (ob::State *state : states)
+        space_->freeState(state);
+    states.clear();
+}
+
+void jy_GeodesicCache::clear()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    while (!entries_.empty())
+        erase(entries_.begin());
+}
+
+GeodesicCacheStats jy_GeodesicCache::getStats() const
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    return {lookups_, hits_, evictions_, entries_.size(), lookups_ > 0 ? (double)hits_ / lookups_ : 0.};
+}
+
+void jy_GeodesicCache::resetStats()
+{
+    std::lock_guard<std::mutex> lock(mutex_);
+    lookups_ = hits_ = evictions_ = 0;
+}
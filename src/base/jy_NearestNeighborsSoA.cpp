@@ -0,0 +1,69 @@
+#include <constraint_planner/base/jy_NearestNeighborsSoA.h>
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#include <immintrin.h>
+#define JY_SOA_AVX2
+#endif
+
+namespace
+{
+    void squaredDistancesScalar(const double *coordinates, std::size_t blocks, const double *q, double *out)
+    {
+        for (std::size_t b = 0; b < blocks; b++, coordinates += jy_soa::Dim * jy_soa::Lanes, out += jy_soa::Lanes)
+        {
+            double sum[jy_soa::Lanes] = {0, 0, 0, 0};
+            for (unsigned int d = 0; d < jy_soa::Dim; d++)
+            {
+                for (unsigned int l = 0; l < jy_soa::Lanes; l++)
+                {
+                    const double diff = coordinates[d * jy_soa::Lanes + l] - q[d];
+                    sum[l] += diff * diff;
+                }
+            }
+            for (unsigned int l = 0; l < jy_soa::Lanes; l++)
+                out[l] = sum[l];
+        }
+    }
+
+#ifdef JY_SOA_AVX2
+    // compiled for AVX2 + FMA on its own, the rest of the build keeps the default target
+    __attribute__((target("avx2,fma"))) void squaredDistancesAVX2(const double *coordinates, std::size_t blocks,
+                                                                  const double *q, double *out)
+    {
+        __m256d qd[jy_soa::Dim];
+        for (unsigned int d = 0; d < jy_soa::Dim; d++)
+            qd[d] = _mm256_set1_pd(q[d]);
+
+        for (std::size_t b = 0; b < blocks; b++, coordinates += jy_soa::Dim * jy_soa::Lanes, out += jy_soa::Lanes)
+        {
+            // two accumulators break the dependency chain of the fma
+            __m256d even = _mm256_setzero_pd(), odd = _mm256_setzero_pd();
+            for (unsigned int d = 0; d < jy_soa::Dim; d += 2)
+            {
+                const __m256d e = _mm256_sub_pd(_mm256_loadu_pd(coordinates + d * jy_soa::Lanes), qd[d]);
+                const __m256d o = _mm256_sub_pd(_mm256_loadu_pd(coordinates + (d + 1) * jy_soa::Lanes), qd[d + 1]);
+                even = _mm256_fmadd_pd(e, e, even);
+                odd = _mm256_fmadd_pd(o, o, odd);
+            }
+            _mm256_storeu_pd(out, _mm256_add_pd(even, odd));
+        }
+    }
+#endif
+
+    typedef void (*Kernel)(const double *, std::size_t, const double *, double *);
+
+    Kernel selectKernel()
+    {
+#ifdef JY_SOA_AVX2
+        if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma"))
+            return squaredDistancesAVX2;
+#endif
+        return squaredDistancesScalar;
+    }
+}
+
+void jy_soa::squaredDistances(const double *coordinates, std::size_t blocks, const double *q, double *out)
+{
+    static const Kernel kernel = selectKernel();
+    kernel(coordinates, blocks, q, out);
+}
@@ -0,0 +1,68 @@
+#include <constraint_planner/base/jy_ObjectStateSampler.h>
+#include <constraint_planner/kinematics/panda_model_updater.h>
+#include <utility>
+
+jy_ObjectStateSampler::jy_ObjectStateSampler(const jy_ProjectedStateSpace *space, ob::StateSamplerPtr sampler,
+                                             const Eigen::Affine3d &base_serve, const Eigen::Affine3d &base_main,
+                                             const Eigen::Affine3d &obj_Sgrasp, const Eigen::Affine3d &obj_Mgrasp)
+  : jy_ProjectedStateSampler(space, std::move(sampler))
+  , base_serve_inv_(base_serve.inverse())
+  , base_main_inv_(base_main.inverse())
+  , obj_Sgrasp_(obj_Sgrasp)
+  , obj_Mgrasp_(obj_Mgrasp)
+  , low_(1.0, -0.3, 0.8)
+  , high_(1.3, 0.4, 1.2)
+  , nominal_(Eigen::Quaterniond::Identity())
+{
+}
+
+void jy_ObjectStateSampler::setWorkspace(const Eigen::Vector3d &low, const Eigen::Vector3d &high)
+{
+    low_ = low;
+    high_ = high;
+}
+
+void jy_ObjectStateSampler::setOrientation(const Eigen::Quaterniond &nominal, double max_angle)
+{
+    nominal_ = nominal.normalized();
+    max_angle_ = max_angle;
+}
+
+Eigen::Affine3d jy_ObjectStateSampler::sampleObjectPose()
+{
+    Eigen::Affine3d base_obj = Eigen::Affine3d::Identity();
+    for (int i = 0; i < 3; i++)
+        base_obj.translation()[i] = rng_.uniformReal(low_[i], high_[i]);
+
+    Eigen::Vector3d axis(rng_.gaussian01(), rng_.gaussian01(), rng_.gaussian01());
+    base_obj.linear() = (nominal_ * Eigen::AngleAxisd(rng_.uniformReal(0, max_angle_), axis.normalized())).toRotationMatrix();
+    return base_obj;
+}
+
+void jy_ObjectStateSampler::sampleUniform(ob::State *state)
+{
+    if (popProduced(state))
+        return;
+
+    samples_++;
+    panda_ik &solver = panda_ik_pool::get();
+    Eigen::Map<Eigen::VectorXd> &q = *state->as<ob::ConstrainedStateSpace::StateType>();
+
+    for (unsigned int i = 0; i < attempts_; i++)
+    {
+        Eigen::Affine3d base_obj = sampleObjectPose();
+        serve_solutions_.clear();
+        main_solutions_.clear();
+        if (!solver.solveAll(base_serve_inv_ * base_obj * obj_Sgrasp_, ik_steps_, serve_solutions_) ||
+            !solver.solveAll(base_main_inv_ * base_obj * obj_Mgrasp_, ik_steps_, main_solutions_))
+            continue;
+
+        q.segment<7>(0) = serve_solutions_[rng_.uniformInt(0, serve_solutions_.size() - 1)];
+        q.segment<7>(7) = main_solutions_[rng_.uniformInt(0, main_solutions_.size() - 1)];
+        if (constraint_->project(state))
+            return;
+    }
+
+    fallbacks_++;
+    jy_ProjectedStateSampler::sampleUniform(state);
+}
@@ -1,5 +1,9 @@
 #include <constraint_planner/base/jy_ProjectedStateSpace.h>
+#include <constraint_planner/base/jy_SampleProducer.h>
 #include <Eigen/Core>
+#include <Eigen/Dense>
+#include <algorithm>
+#include <cmath>
 #include <utility>
 
 jy_ProjectedStateSampler::jy_ProjectedStateSampler(const jy_ProjectedStateSpace *space, ob::StateSamplerPtr sampler)
@@ -7,29 +11,106 @@ jy_ProjectedStateSampler::jy_ProjectedStateSampler(const jy_ProjectedStateSpace
 {
 }
 
+bool jy_ProjectedStateSampler::popProduced(ob::State *state)
+{
+    return producer_ && producer_->pop(state);
+}
+
 void jy_ProjectedStateSampler::sampleUniform(ob::State *state)
 {
+    if (popProduced(state))
+        return;
     ob::WrapperStateSampler::sampleUniform(state);
     constraint_->project(state);
     // space_->enforceBounds(state);
 }
 
+void jy_ProjectedStateSampler::tangentBasis(const ob::State *state)
+{
+    const auto &x = *state->as<ob::ConstrainedStateSpace::StateType>();
+    if (tangent_at_.size() == x.size() && tangent_at_ == x)
+        return;
+
+    const unsigned int n = constraint_->getAmbientDimension();
+    const unsigned int k = constraint_->getCoDimension();
+    jacobian_.resize(k, n);
+    constraint_->jacobian(x, jacobian_);
+
+    // the last n - k columns of Q in J^T = QR are orthogonal to every row of J
+    Eigen::HouseholderQR<Eigen::MatrixXd> qr(jacobian_.transpose());
+    tangent_ = (qr.householderQ() * Eigen::MatrixXd::Identity(n, n)).rightCols(n - k);
+    tangent_at_ = x;
+}
+
 void jy_ProjectedStateSampler::sampleUniformNear(ob::State *state, const ob::State *near, const double distance)
 {
-    ob::WrapperStateSampler::sampleUniformNear(state, near, distance);
+    tangentBasis(near);
+
+    // uniform in the ball of radius distance of the tangent space : gaussian direction, radius ~ u^(1/m)
+    const unsigned int m = tangent_.cols();
+    step_.resize(m);
+    for (unsigned int i = 0; i < m; i++)
+        step_[i] = rng_.gaussian01();
+    const double norm = step_.norm();
+    if (norm > 0)
+        step_ *= distance * std::pow(rng_.uniform01(), 1.0 / m) / norm;
+
+    Eigen::Map<Eigen::VectorXd> &x = *state->as<ob::ConstrainedStateSpace::StateType>();
+    x = *near->as<ob::ConstrainedStateSpace::StateType>() + tangent_ * step_;
     constraint_->project(state);
     // space_->enforceBounds(state);
 }
 
 void jy_ProjectedStateSampler::sampleGaussian(ob::State *state, const ob::State *mean, const double stdDev)
 {
-    ob::WrapperStateSampler::sampleGaussian(state, mean, stdDev);
+    tangentBasis(mean);
+
+    const unsigned int m = tangent_.cols();
+    step_.resize(m);
+    for (unsigned int i = 0; i < m; i++)
+        step_[i] = rng_.gaussian(0, stdDev);
+
+    Eigen::Map<Eigen::VectorXd> &x = *state->as<ob::ConstrainedStateSpace::StateType>();
+    x = *mean->as<ob::ConstrainedStateSpace::StateType>() + tangent_ * step_;
     constraint_->project(state);
     space_->enforceBounds(state);
 }
 
 bool jy_ProjectedStateSpace::discreteGeodesic(const ob::State *from, const ob::State *to, bool interpolate,
-                                                       std::vector<ob::State *> *geodesic) const
+                                              std::vector<ob::State *> *geodesic) const
+{
+    // a walk shorter than one step costs less than the cache
+    if (cache_.getCapacity() == 0 || distance(from, to) <= delta_)
+        return walkGeodesic(from, to, interpolate, geodesic);
+
+    bool result;
+    if (cache_.lookup(from, to, interpolate, geodesic, result))
+        return result;
+
+    if (geodesic != nullptr || !cache_.getStoreGeodesics())
+    {
+        result = walkGeodesic(from, to, interpolate, geodesic);
+        cache_.insert(from, to, interpolate, result, nullptr, geodesic);
+        return result;
+    }
+
+    // nobody asked for the states, the cache keeps them for the interpolation that usually follows
+    std::vector<ob::State *> states;
+    result = walkGeodesic(from, to, interpolate, &states);
+    cache_.insert(from, to, interpolate, result, &states, nullptr);
+    return result;
+}
+
+bool jy_ProjectedStateSpace::walkGeodesic(const ob::State *from, const ob::State *to, bool interpolate,
+                                          std::vector<ob::State *> *geodesic) const
+{
+    if (geodesic_type_ == PREDICTOR_CORRECTOR)
+        return predictorCorrectorGeodesic(from, to, interpolate, geodesic);
+    return interpolateProjectGeodesic(from, to, interpolate, geodesic);
+}
+
+bool jy_ProjectedStateSpace::interpolateProjectGeodesic(const ob::State *from, const ob::State *to, bool interpolate,
+                                                        std::vector<ob::State *> *geodesic) const
 {
     // Save a copy of the from state.
     if (geodesic != nullptr)
@@ -88,3 +169,178 @@ bool jy_ProjectedStateSpace::discreteGeodesic(const ob::State *from, const ob::S
 
     return dist <= tolerance;
 }
+
+namespace
+{
+    /* buffers of predictorCorrectorGeodesic(), one set per thread, only resized when the dimensions change */
+    struct GeodesicWorkspace
+    {
+        Eigen::MatrixXd j, jjt;
+        Eigen::VectorXd f, tangent, predicted, normal, multipliers;
+        Eigen::LDLT<Eigen::MatrixXd> ldlt;
+
+        void resize(unsigned int n, unsigned int k)
+        {
+            j.resize(k, n);
+            jjt.resize(k, k);
+            f.resize(k);
+            normal.resize(k);
+            multipliers.resize(k);
+            tangent.resize(n);
+            predicted.resize(n);
+        }
+
+        /* v -= J^T (J J^T)^-1 r : the minimum norm change of v that moves J v by -r */
+        void minimumNormStep(Eigen::Ref<Eigen::VectorXd> v, const Eigen::VectorXd &r)
+        {
+            jjt.noalias() = j * j.transpose();
+            ldlt.compute(jjt);
+            multipliers = ldlt.solve(r);
+            v.noalias() -= j.transpose() * multipliers;
+        }
+    };
+
+    GeodesicWorkspace &geodesicWorkspace(unsigned int n, unsigned int k)
+    {
+        thread_local GeodesicWorkspace workspace;
+        workspace.resize(n, k);
+        return workspace;
+    }
+}
+
+void jy_ProjectedStateSpace::evaluate(const Eigen::Ref<const Eigen::VectorXd> &x, Eigen::VectorXd &f, Eigen::MatrixXd &j) const
+{
+    if (chain_ != nullptr)
+        return chain_->evaluate(x, f, j);
+    constraint_->function(x, f);
+    constraint_->jacobian(x, j);
+}
+
+bool jy_ProjectedStateSpace::isSatisfied(const Eigen::VectorXd &f) const
+{
+    if (chain_ != nullptr)
+        return chain_->isResidualSatisfied(f);
+    return f.allFinite() && f.norm() <= constraint_->getTolerance();
+}
+
+bool jy_ProjectedStateSpace::predictorCorrectorGeodesic(const ob::State *from, const ob::State *to, bool interpolate,
+                                                        std::vector<ob::State *> *geodesic) const
+{
+    if (geodesic != nullptr)
+    {
+        geodesic->clear();
+        geodesic->push_back(cloneState(from));
+    }
+
+    const double tolerance = delta_;
+
+    double dist, step, total = 0;
+    if ((dist = distance(from, to)) <= tolerance)
+        return true;
+
+    const double max = dist * lambda_;
+    const double min_step = delta_ / 16;
+
+    auto previous = cloneState(from);
+    auto scratch = allocState();
+
+    auto &&svc = si_->getStateValidityChecker();
+
+    const Eigen::Map<Eigen::VectorXd> &x_previous = *previous->as<StateType>();
+    Eigen::Map<Eigen::VectorXd> &x = *scratch->as<StateType>();
+    const auto &x_to = *to->as<StateType>();
+
+    GeodesicWorkspace &w = geodesicWorkspace(constraint_->getAmbientDimension(), constraint_->getCoDimension());
+    Eigen::MatrixXd &j = w.j;
+    Eigen::VectorXd &f = w.f, &tangent = w.tangent, &predicted = w.predicted;
+
+    unsigned long steps = 0, corrections = 0, rejections = 0, fallbacks = 0;
+    double h = delta_;
+    bool jacobian_at_previous = false; // j still holds the jacobian of the last accepted corrector iterate
+    do
+    {
+        // predictor : the goal direction without its component normal to the manifold
+        if (!jacobian_at_previous)
+            constraint_->jacobian(previous, j);
+        jacobian_at_previous = false;
+        tangent = x_to - x_previous;
+        w.normal.noalias() = j * tangent;
+        w.minimumNormStep(tangent, w.normal);
+        const double length = tangent.norm();
+        if (length < 1e-12)
+            break; // the goal is straight off the manifold from here
+
+        const double predicted_step = std::min(h, dist);
+        predicted = x_previous + predicted_step / length * tangent;
+        x = predicted;
+
+        // corrector : minimum norm Newton steps back onto the manifold, one kinematics pass per iterate gives
+        // both the convergence test and the step
+        bool satisfied;
+        unsigned int iter = 0;
+        evaluate(x, f, j);
+        while (!(satisfied = isSatisfied(f)) && iter < corrector_iterations_)
+        {
+            w.minimumNormStep(x, f);
+            iter++;
+            evaluate(x, f, j);
+        }
+        corrections += iter;
+        bool projected = false;
+
+        const double correction = (x - predicted).norm();
+        if (!satisfied || correction > 0.5 * predicted_step)
+        {
+            // too curved for this step : retry shorter, and leave the last resort to a full projection
+            if (h > min_step)
+            {
+                h = std::max(min_step, h / 2);
+                rejections++;
+                continue;
+            }
+            fallbacks++;
+            if (!constraint_->project(scratch))
+                break;
+            projected = true;
+        }
+
+        if (!(interpolate || svc->isValid(scratch))                 // not valid
+            || (step = distance(previous, scratch)) > lambda_ * delta_) // deviated
+            break;
+
+        // Check if we have wandered too far
+        total += step;
+        if (total > max)
+            break;
+
+        // Check if we are no closer than before
+        const double newDist = distance(scratch, to);
+        if (newDist >= dist)
+            break;
+
+        dist = newDist;
+        copyState(previous, scratch);
+        jacobian_at_previous = !projected; // the corrector's last evaluate() was at the accepted state
+        steps++;
+
+        if (geodesic != nullptr)
+            geodesic->push_back(cloneState(scratch));
+
+        // next step from the curvature seen on this one, shorter again when the corrector used all its iterations
+        const double curvature = 2 * correction / (predicted_step * predicted_step);
+        h = (curvature > 0) ? std::min(delta_, 0.2 / curvature) : delta_;
+        if (iter >= corrector_iterations_)
+            h /= 2;
+        h = std::max(min_step, h);
+    } while (dist >= tolerance);
+    freeState(scratch);
+    freeState(previous);
+
+    geodesic_calls_++;
+    geodesic_steps_ += steps;
+    geodesic_corrections_ += corrections;
+    geodesic_rejections_ += rejections;
+    geodesic_fallbacks_ += fallbacks;
+
+    return dist <= tolerance;
+}
@@ -0,0 +1,165 @@
+#include <constraint_planner/base/jy_SampleProducer.h>
+
+#include <ompl/base/spaces/constraint/ConstrainedStateSpace.h>
+
+#include <algorithm>
+#include <utility>
+
+jy_SampleRing::jy_SampleRing(std::size_t capacity, unsigned int dimension) : dimension_(dimension)
+{
+    std::size_t size = 2;
+    while (size < capacity)
+        size <<= 1;
+    mask_ = size - 1;
+
+    cells_.reset(new Cell[size]);
+    for (std::size_t i = 0; i < size; i++)
+        cells_[i].sequence.store(i, std::memory_order_relaxed);
+    values_.resize(size * dimension_);
+}
+
+bool jy_SampleRing::push(const double *values)
+{
+    Cell *cell;
+    std::size_t pos = enqueue_pos_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        const std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)pos;
+        if (diff == 0)
+        {
+            if (enqueue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false; // full
+        else
+            pos = enqueue_pos_.load(std::memory_order_relaxed);
+    }
+
+    std::copy(values, values + dimension_, &values_[(pos & mask_) * dimension_]);
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+bool jy_SampleRing::pop(double *values)
+{
+    Cell *cell;
+    std::size_t pos = dequeue_pos_.load(std::memory_order_relaxed);
+    while (true)
+    {
+        cell = &cells_[pos & mask_];
+        const std::size_t sequence = cell->sequence.load(std::memory_order_acquire);
+        const std::ptrdiff_t diff = (std::ptrdiff_t)sequence - (std::ptrdiff_t)(pos + 1);
+        if (diff == 0)
+        {
+            if (dequeue_pos_.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+                break;
+        }
+        else if (diff < 0)
+            return false; // empty
+        else
+            pos = dequeue_pos_.load(std::memory_order_relaxed);
+    }
+
+    const double *cell_values = &values_[(pos & mask_) * dimension_];
+    std::copy(cell_values, cell_values + dimension_, values);
+    cell->sequence.store(pos + mask_ + 1, std::memory_order_release);
+    return true;
+}
+
+std::size_t jy_SampleRing::size() const
+{
+    const std::size_t enqueued = enqueue_pos_.load(std::memory_order_relaxed);
+    const std::size_t dequeued = dequeue_pos_.load(std::memory_order_relaxed);
+    return enqueued > dequeued ? std::min(enqueued - dequeued, capacity()) : 0;
+}
+
+jy_SampleProducer::jy_SampleProducer(ob::SpaceInformationPtr si, SamplerAllocator allocator, unsigned int threads,
+                                     std::size_t capacity)
+  : si_(std::move(si))
+  , allocator_(std::move(allocator))
+  , threads_(std::max(1u, threads))
+  , ring_(capacity, si_->getStateSpace()->as<ob::ConstrainedStateSpace>()->getAmbientDimension())
+{
+}
+
+jy_SampleProducer::~jy_SampleProducer()
+{
+    stop();
+}
+
+void jy_SampleProducer::start()
+{
+    if (running_)
+        return;
+    running_ = true;
+    start_time_ = std::chrono::steady_clock::now();
+    for (unsigned int i = 0; i < threads_; i++)
+        workers_.emplace_back(&jy_SampleProducer::produce, this);
+}
+
+void jy_SampleProducer::stop()
+{
+    if (running_)
+        stop_time_ = std::chrono::steady_clock::now();
+    running_ = false;
+    for (auto &worker : workers_)
+        worker.join();
+    workers_.clear();
+}
+
+bool jy_SampleProducer::pop(ob::State *state)
+{
+    if (!ring_.pop(state->as<ob::ConstrainedStateSpace::StateType>()->data()))
+    {
+        starved_++;
+        return false;
+    }
+    consumed_++;
+    return true;
+}
+
+void jy_SampleProducer::produce()
+{
+    ob::StateSamplerPtr sampler = allocator_();
+    const ob::ConstraintPtr &constraint = si_->getStateSpace()->as<ob::ConstrainedStateSpace>()->getConstraint();
+    ob::State *state = si_->allocState();
+    const double *values = state->as<ob::ConstrainedStateSpace::StateType>()->data();
+
+    while (running_)
+    {
+        if (ring_.size() >= ring_.capacity())
+        {
+            std::this_thread::sleep_for(std::chrono::microseconds(200));
+            continue;
+        }
+
+        sampler->sampleUniform(state);
+        if (!si_->satisfiesBounds(state) || !constraint->isSatisfied(state) || !si_->isValid(state))
+        {
+            rejected_++;
+            continue;
+        }
+
+        // another worker can fill the last cell between the size check and here, the state is dropped then
+        if (ring_.push(values))
+            produced_++;
+    }
+    si_->freeState(state);
+}
+
+SampleProducerStats jy_SampleProducer::getStats() const
+{
+    const std::chrono::duration<double> elapsed = (running_ ? std::chrono::steady_clock::now() : stop_time_) - start_time_;
+    const unsigned long produced = produced_;
+    return {ring_.size(), ring_.capacity(), produced, rejected_, consumed_, starved_,
+            elapsed.count() > 0 ? produced / elapsed.count() : 0.};
+}
+
+void jy_SampleProducer::resetStats()
+{
+    produced_ = rejected_ = consumed_ = starved_ = 0;
+    start_time_ = stop_time_ = std::chrono::steady_clock::now();
+}
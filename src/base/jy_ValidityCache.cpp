@@ -0,0 +1,89 @@
+#include <constraint_planner/base/jy_ValidityCache.h>
+
+#include <cmath>
+
+namespace
+{
+    // splitmix64 finalizer, spreads the quantized coordinates over the whole word
+    std::uint64_t mix(std::uint64_t x)
+    {
+        x = (x ^ (x >> 30)) * 0xbf58476d1ce4e5b9ULL;
+        x = (x ^ (x >> 27)) * 0x94d049bb133111ebULL;
+        return x ^ (x >> 31);
+    }
+}
+
+jy_ValidityCache::jy_ValidityCache(unsigned int dimension, std::size_t capacity, double resolution)
+  : dimension_(dimension), resolution_(resolution)
+{
+    setCapacity(capacity);
+}
+
+void jy_ValidityCache::setCapacity(std::size_t capacity)
+{
+    std::size_t slots = 0;
+    if (capacity > 0)
+        for (slots = 1; slots < capacity; slots <<= 1)
+            ;
+    slots_.reset(slots > 0 ? new std::atomic<std::uint64_t>[slots] : nullptr);
+    for (std::size_t i = 0; i < slots; i++)
+        slots_[i].store(0, std::memory_order_relaxed);
+    capacity_ = slots;
+}
+
+void jy_ValidityCache::setResolution(double resolution)
+{
+    resolution_ = resolution;
+    invalidate(); // cells of the old grid mean nothing in the new one
+}
+
+std::uint64_t jy_ValidityCache::key(const double *q) const
+{
+    std::uint64_t hash = mix(generation_.load(std::memory_order_relaxed) + 0x9e3779b97f4a7c15ULL);
+    for (unsigned int i = 0; i < dimension_; i++)
+    {
+        const std::int64_t cell = std::llround(q[i] / resolution_);
+        hash = mix(hash ^ (std::uint64_t)cell);
+    }
+    hash &= ~std::uint64_t(1);
+    return hash == 0 ? 2 : hash;
+}
+
+bool jy_ValidityCache::lookup(const double *q, bool &valid) const
+{
+    if (capacity_ == 0)
+        return false;
+    lookups_.fetch_add(1, std::memory_order_relaxed);
+    const std::uint64_t k = key(q);
+    const std::uint64_t slot = slots_[(k >> 1) & (capacity_ - 1)].load(std::memory_order_relaxed);
+    if ((slot & ~std::uint64_t(1)) != k)
+        return false;
+    hits_.fetch_add(1, std::memory_order_relaxed);
+    valid = slot & 1;
+    return true;
+}
+
+void jy_ValidityCache::insert(const double *q, bool valid)
+{
+    if (capacity_ == 0)
+        return;
+    inserts_.fetch_add(1, std::memory_order_relaxed);
+    const std::uint64_t k = key(q);
+    slots_[(k >> 1) & (capacity_ - 1)].store(k | (valid ? 1 : 0), std::memory_order_relaxed);
+}
+
+void jy_ValidityCache::invalidate()
+{
+    generation_.fetch_add(1, std::memory_order_relaxed);
+}
+
+ValidityCacheStats jy_ValidityCache::getStats() const
+{
+    const unsigned long lookups = lookups_, hits = hits_;
+    return {lookups, hits, inserts_, capacity_, lookups > 0 ? (double)hits / lookups : 0.};
+}
+
+void jy_ValidityCache::resetStats()
+{
+    lookups_ = hits_ = inserts_ = 0;
+}
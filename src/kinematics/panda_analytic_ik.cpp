@@ -0,0 +1,181 @@
+#include <constraint_planner/kinematics/panda_analytic_ik.h>
+
+#include <cmath>
+
+using namespace Eigen;
+
+namespace
+{
+  // modified DH parameters of the Panda (a_{i-1}, d_i, alpha_{i-1}), flange offset and hand rotation from the URDF
+  const double a3 = 0.0825;   // a3 = -a4
+  const double d3 = 0.316;    // shoulder -> elbow
+  const double d5 = 0.384;    // elbow -> wrist
+  const double a6 = 0.088;    // wrist -> joint 7
+  const double d1 = 0.333;    // base -> shoulder
+  const double d_flange = 0.107;
+  const double hand_yaw = -M_PI / 4;
+
+  const double dh_a[7] = {0, 0, 0, a3, -a3, 0, a6};
+  const double dh_d[7] = {d1, 0, d3, 0, d5, 0, 0};
+  const double dh_alpha[7] = {0, -M_PI / 2, M_PI / 2, M_PI / 2, -M_PI / 2, M_PI / 2, M_PI / 2};
+
+  const double solution_tolerance = 1e-6;
+
+  Matrix3d rotX(double angle) { return AngleAxisd(angle, Vector3d::UnitX()).toRotationMatrix(); }
+  Matrix3d rotZ(double angle) { return AngleAxisd(angle, Vector3d::UnitZ()).toRotationMatrix(); }
+}
+
+panda_analytic_ik::panda_analytic_ik()
+{
+  // one turn per joint until the owner sets the real limits
+  lower_.setConstant(-M_PI);
+  upper_.setConstant(M_PI);
+}
+
+void panda_analytic_ik::setJointLimits(const Vector7d &lower, const Vector7d &upper)
+{
+  lower_ = lower;
+  upper_ = upper;
+}
+
+Affine3d panda_analytic_ik::forwardKinematics(const Vector7d &q) const
+{
+  Affine3d transform = Affine3d::Identity();
+  for (int i = 0; i < 7; i++)
+  {
+    transform.rotate(rotX(dh_alpha[i]));
+    transform.translate(Vector3d(dh_a[i], 0, 0));
+    transform.rotate(rotZ(q[i]));
+    transform.translate(Vector3d(0, 0, dh_d[i]));
+  }
+  transform.translate(Vector3d(0, 0, d_flange));
+  transform.rotate(rotZ(hand_yaw));
+  return transform;
+}
+
+bool panda_analytic_ik::wrapToLimits(Vector7d &q) const
+{
+  for (int i = 0; i < 7; i++)
+  {
+    if (q[i] < lower_[i])
+      q[i] += 2 * M_PI;
+    else if (q[i] > upper_[i])
+      q[i] -= 2 * M_PI;
+
+    if (q[i] < lower_[i] || q[i] > upper_[i])
+      return false;
+  }
+  return true;
+}
+
+unsigned int panda_analytic_ik::solve(const Affine3d &target, double q7, std::vector<Vector7d> &solutions) const
+{
+  if (q7 < lower_[6] || q7 > upper_[6])
+    return 0;
+
+  // targets built from rounded quaternions are off orthonormal by more than the FK check below allows
+  const Matrix3d R_target = Quaterniond(target.linear()).normalized().toRotationMatrix();
+
+  // flange -> joint 7 -> frame 6, whose origin is the wrist center (frame 5 and 6 share it)
+  const Matrix3d R7 = R_target * rotZ(-hand_yaw);
+  const Vector3d O7 = target.translation() - d_flange * R7.col(2);
+  const Matrix3d R6 = R7 * rotZ(-q7) * rotX(-dh_alpha[6]);
+  const Vector3d wrist = O7 - a6 * R6.col(0);
+
+  // |wrist - shoulder|^2 = A + B cos(q4) + C sin(q4)
+  const Vector3d shoulder(0, 0, d1);
+  const Vector3d w = wrist - shoulder;
+  const double A = 2 * a3 * a3 + d5 * d5 + d3 * d3;
+  const double B = 2 * (d5 * d3 - a3 * a3);
+  const double C = -2 * a3 * (d5 + d3);
+  const double cos_elbow = (w.squaredNorm() - A) / std::hypot(B, C);
+  if (std::abs(cos_elbow) > 1.0)
+    return 0;
+
+  const Vector3d z6 = R6.col(2);
+  const Vector3d w_hat = w.normalized();
+
+  unsigned int found = 0;
+  const double elbow_offset = std::atan2(C, B);
+  for (double elbow_sign : {1.0, -1.0})
+  {
+    const double q4 = elbow_offset + elbow_sign * std::acos(cos_elbow);
+    const double s4 = std::sin(q4), c4 = std::cos(q4);
+
+    // wrist and joint 5 axis expressed in frame 3, which only depends on q4
+    const Vector3d w3(a3 - a3 * c4 - d5 * s4, 0, d3 - a3 * s4 + d5 * c4);
+    const Vector3d z5(-s4, 0, c4);
+
+    // R3 = Rot(w_hat, swivel) * R0 with R0 any rotation taking w3 onto w; the swivel is fixed by z5 . z6 = 0
+    const Matrix3d R0 = Quaterniond::FromTwoVectors(w3, w).toRotationMatrix();
+    const Vector3d p = R0 * z5;
+    const Vector3d p_par = w_hat.dot(p) * w_hat;
+    const double alpha = p_par.dot(z6);
+    const double beta = (p - p_par).dot(z6);
+    const double gamma = w_hat.cross(p).dot(z6);
+    const double r = std::hypot(beta, gamma);
+    if (r < 1e-12 || std::abs(alpha) > r)
+      continue;
+
+    const double swivel_offset = std::atan2(gamma, beta);
+    const double swivel_range = std::acos(-alpha / r);
+    for (double swivel_sign : {1.0, -1.0})
+    {
+      const Matrix3d R3 = AngleAxisd(swivel_offset + swivel_sign * swivel_range, w_hat).toRotationMatrix() * R0;
+
+      // R3 = RotZ(q1) RotY(q2) RotZ(q3)
+      const double s2 = std::hypot(R3(0, 2), R3(1, 2));
+      for (double shoulder_sign : {1.0, -1.0})
+      {
+        Vector7d q;
+        q[1] = std::atan2(shoulder_sign * s2, R3(2, 2));
+        if (s2 > 1e-9)
+        {
+          q[0] = std::atan2(shoulder_sign * R3(1, 2), shoulder_sign * R3(0, 2));
+          q[2] = std::atan2(shoulder_sign * R3(2, 1), -shoulder_sign * R3(2, 0));
+        }
+        else
+        {
+          // q1 and q3 rotate about the same axis, put it all on q1
+          if (shoulder_sign < 0)
+            continue;
+          q[0] = std::atan2(R3(1, 0), R3(0, 0));
+          q[2] = 0;
+        }
+        q[3] = q4;
+
+        // R4^T R6 = RotY(q5) RotZ(q6)
+        const Matrix3d R4 = R3 * rotX(dh_alpha[3]) * rotZ(q4);
+        const Matrix3d M = R4.transpose() * R6;
+        q[4] = std::atan2(M(0, 2), M(2, 2));
+        q[5] = std::atan2(M(1, 0), M(1, 1));
+        q[6] = q7;
+
+        if (!wrapToLimits(q))
+          continue;
+
+        // drops the spurious branches near singular configurations
+        const Affine3d check = forwardKinematics(q);
+        if ((check.translation() - target.translation()).norm() > solution_tolerance ||
+            (check.linear() - R_target).norm() > solution_tolerance)
+          continue;
+
+        solutions.push_back(q);
+        found++;
+      }
+    }
+  }
+  return found;
+}
+
+unsigned int panda_analytic_ik::solveSweep(const Affine3d &target, unsigned int steps, std::vector<Vector7d> &solutions) const
+{
+  unsigned int found = 0;
+  for (unsigned int i = 0; i < steps; i++)
+  {
+    double q7 = (steps == 1) ? (lower_[6] + upper_[6]) / 2
+                             : lower_[6] + (upper_[6] - lower_[6]) * i / (steps - 1);
+    found += solve(target, q7, solutions);
+  }
+  return found;
+}
@@ -1,13 +1,20 @@
 #include <constraint_planner/kinematics/panda_model_updater.h>
 
-FrankaModelUpdater::FrankaModelUpdater()
+#include <limits>
+#include <cmath>
+#include <cstdlib>
+
+FrankaModelUpdater::FrankaModelUpdater(KINEMATICS_BACKEND backend) : backend_(backend)
 {
+  static std::atomic<unsigned long> next_id{0};
+  id_ = next_id++;
+
   PandaRBDLModel();
 }
 void FrankaModelUpdater::PandaRBDLModel()
 {
-  rbdl_model_ = std::make_shared<Model>();
-  rbdl_model_->gravity = Vector3d(0., 0, -9.81);
+  std::shared_ptr<Model> rbdl_model = std::make_shared<Model>();
+  rbdl_model->gravity = Vector3d(0., 0, -9.81);
 
   double mass[7];
   mass[0] = 4.971e+00;
@@ -18,14 +25,17 @@ void FrankaModelUpdater::PandaRBDLModel()
   mass[5] = 1.667e+00;
   mass[6] = 7.355e-01;
 
-  Vector3d axis[7];
-  axis[0] = Vector3d::UnitZ();
-  axis[1] = Vector3d::UnitY();
-  axis[2] = Vector3d::UnitZ();
-  axis[3] = -1.0 * Vector3d::UnitY();
-  axis[4] = Vector3d::UnitZ();
-  axis[5] = -1.0 * Vector3d::UnitY();
-  axis[6] = -1.0 * Vector3d::UnitZ();
+  axis_[0] = Vector3d::UnitZ();
+  axis_[1] = Vector3d::UnitY();
+  axis_[2] = Vector3d::UnitZ();
+  axis_[3] = -1.0 * Vector3d::UnitY();
+  axis_[4] = Vector3d::UnitZ();
+  axis_[5] = -1.0 * Vector3d::UnitY();
+  axis_[6] = -1.0 * Vector3d::UnitZ();
+
+  body_to_ee_rotation_.setIdentity();
+  body_to_ee_rotation_(1, 1) = -1;
+  body_to_ee_rotation_(2, 2) = -1;
 
   Vector3d global_joint_position[7];
 
@@ -64,23 +74,54 @@ void FrankaModelUpdater::PandaRBDLModel()
   for (int i = 0; i < 7; i++)
   {
     body_[i] = Body(mass[i], com_position_[i], inertia_[i]);
-    joint_[i] = Joint(JointTypeRevolute, axis[i]);
+    joint_[i] = Joint(JointTypeRevolute, axis_[i]);
     if (i == 0)
-      body_id_[i] = rbdl_model_->AddBody(0, Math::Xtrans(joint_position_[i]), joint_[i], body_[i]);
+      body_id_[i] = rbdl_model->AddBody(0, Math::Xtrans(joint_position_[i]), joint_[i], body_[i]);
     else
-      body_id_[i] = rbdl_model_->AddBody(body_id_[i - 1], Math::Xtrans(joint_position_[i]), joint_[i], body_[i]);
+      body_id_[i] = rbdl_model->AddBody(body_id_[i - 1], Math::Xtrans(joint_position_[i]), joint_[i], body_[i]);
   }
+  rbdl_model_ = rbdl_model;
 }
 
-Affine3d FrankaModelUpdater::getTransform(const Vector7d &q)
+Model &FrankaModelUpdater::workspace() const
 {
+  // RBDL writes the kinematic state of every query into the Model, so threads must not share one.
+  // The thread remembers the last workspace it used, the pool is only searched when it switches models
+  struct LastWorkspace
+  {
+    unsigned long id;
+    Model *model;
+  };
+  thread_local LastWorkspace last{std::numeric_limits<unsigned long>::max(), nullptr};
+  if (last.id == id_)
+    return *last.model;
+
+  std::lock_guard<std::mutex> lock(workspaces_mutex_);
+  std::unique_ptr<Model> &model = workspaces_[std::this_thread::get_id()];
+  if (!model)
+    model.reset(new Model(*rbdl_model_));
+  last.id = id_;
+  last.model = model.get();
+  return *model;
+}
+
+Affine3d FrankaModelUpdater::getTransform(const Vector7d &q) const
+{
+  if (backend_ == CLOSED_FORM_KINEMATICS)
+    return Affine3d(forwardKinematics(q));
+  return getTransformRBDL(q);
+}
+
+Affine3d FrankaModelUpdater::getTransformRBDL(const Vector7d &q) const
+{
+  Model &model = workspace();
   VectorXd q_temp_ = q;
   VectorXd qdot_temp_;
   qdot_temp_.setZero(7);
 
-  UpdateKinematicsCustom(*rbdl_model_, &q_temp_, &qdot_temp_, NULL);
-  auto x = CalcBodyToBaseCoordinates(*rbdl_model_, q, body_id_[7 - 1], com_position_[7 - 1], true);
-  auto rotation = CalcBodyWorldOrientation(*rbdl_model_, q, body_id_[7 - 1], true).transpose();
+  UpdateKinematicsCustom(model, &q_temp_, &qdot_temp_, NULL);
+  auto x = CalcBodyToBaseCoordinates(model, q, body_id_[7 - 1], com_position_[7 - 1], true);
+  Matrix3d rotation = CalcBodyWorldOrientation(model, q, body_id_[7 - 1], true).transpose();
 
   Matrix3d body_to_ee_rotation;
   body_to_ee_rotation.setIdentity();
@@ -96,11 +137,39 @@ Affine3d FrankaModelUpdater::getTransform(const Vector7d &q)
   return transform;
 }
 
-Matrix<double, 6, 7> FrankaModelUpdater::getJacobian(const Vector7d &q)
+Isometry3d FrankaModelUpdater::forwardKinematics(const Vector7d &q) const
+{
+  // every body frame is the parent frame translated by joint_position_[i] and rotated about axis_[i]
+  Matrix3d rotation = Matrix3d::Identity();
+  Vector3d position = Vector3d::Zero();
+  for (int i = 0; i < 7; i++)
+  {
+    position.noalias() += rotation * joint_position_[i];
+    rotation = rotation * AngleAxisd(q[i], axis_[i]).toRotationMatrix();
+  }
+
+  Isometry3d transform;
+  transform.linear() = rotation * body_to_ee_rotation_;
+  transform.translation() = position + rotation * com_position_[7 - 1];
+  transform.makeAffine();
+  return transform;
+}
+
+double FrankaModelUpdater::checkForwardKinematics(const Vector7d &q) const
+{
+  Affine3d rbdl_transform = getTransformRBDL(q);
+
+  Isometry3d transform = forwardKinematics(q);
+  double position_error = (transform.translation() - rbdl_transform.translation()).cwiseAbs().maxCoeff();
+  double rotation_error = (transform.linear() - rbdl_transform.linear()).cwiseAbs().maxCoeff();
+  return std::max(position_error, rotation_error);
+}
+
+Matrix<double, 6, 7> FrankaModelUpdater::getJacobian(const Vector7d &q) const
 {
   MatrixXd j_temp;
   j_temp.resize(6, 7);
-  CalcPointJacobian6D(*rbdl_model_, q, body_id_[7 - 1], com_position_[7 - 1], j_temp, true);
+  CalcPointJacobian6D(workspace(), q, body_id_[7 - 1], com_position_[7 - 1], j_temp, true);
 
   Matrix<double, 6, 7> j;
   for (int i = 0; i < 2; i++)
@@ -109,25 +178,60 @@ Matrix<double, 6, 7> FrankaModelUpdater::getJacobian(const Vector7d &q)
   return j;
 }
 
-Matrix<double, 7, 7> FrankaModelUpdater::getMassMatrix(const Vector7d &q)
+void FrankaModelUpdater::getTransformAndJacobian(const Vector7d &q, Affine3d &transform, Matrix<double, 6, 7> &jacobian) const
+{
+  if (backend_ == RBDL_KINEMATICS)
+  {
+    transform = getTransform(q);
+    jacobian = getJacobian(q);
+    return;
+  }
+
+  // same chain as forwardKinematics(), keeping the joint origins and world axes on the way
+  Matrix3d rotation = Matrix3d::Identity();
+  Vector3d position = Vector3d::Zero();
+  Vector3d joint_origin[7], joint_axis[7];
+  for (int i = 0; i < 7; i++)
+  {
+    position.noalias() += rotation * joint_position_[i];
+    rotation = rotation * AngleAxisd(q[i], axis_[i]).toRotationMatrix();
+    joint_origin[i] = position;
+    joint_axis[i] = rotation * axis_[i];
+  }
+  Vector3d ee_position = position + rotation * com_position_[7 - 1];
+
+  transform.setIdentity();
+  transform.linear() = rotation * body_to_ee_rotation_;
+  transform.translation() = ee_position;
+
+  // [linear; angular], the same layout as getJacobian()
+  for (int i = 0; i < 7; i++)
+  {
+    jacobian.block<3, 1>(0, i) = joint_axis[i].cross(ee_position - joint_origin[i]);
+    jacobian.block<3, 1>(3, i) = joint_axis[i];
+  }
+}
+
+Matrix<double, 7, 7> FrankaModelUpdater::getMassMatrix(const Vector7d &q) const
 {
   MatrixXd m_temp;
   m_temp.resize(7, 7);
   Matrix<double, 7, 7> mass;
-  CompositeRigidBodyAlgorithm(*rbdl_model_, q, m_temp, true);
+  CompositeRigidBodyAlgorithm(workspace(), q, m_temp, true);
 
   return m_temp;
 }
 
-Matrix<double, 7, 1> FrankaModelUpdater::getGravity(const Vector7d &q)
+Matrix<double, 7, 1> FrankaModelUpdater::getGravity(const Vector7d &q) const
 {
   VectorXd g_temp;
   g_temp.resize(7);
-  NonlinearEffects(*rbdl_model_, q, Matrix<double, 7, 1>::Zero(), g_temp);
+  NonlinearEffects(workspace(), q, Matrix<double, 7, 1>::Zero(), g_temp);
   return g_temp;
 }
 
-panda_ik::panda_ik() : tracik_solver(chain_start, chain_end, "/single_robot_description", TRAC_IK::SolveType::Manip1)
+// 2 s and Speed are what this solver has always run with : the SolveType used to be passed in the maxtime slot
+panda_ik::panda_ik() : tracik_solver(chain_start, chain_end, "/single_robot_description", 2.0, 1e-5, TRAC_IK::Speed)
 {
   KDL::JntArray ll, ul; //lower joint limits, upper joint limits
 
@@ -144,7 +248,17 @@ panda_ik::panda_ik() : tracik_solver(chain_start, chain_end, "/single_robot_desc
     std::cout << "error~~~~~`" << std::endl;
     return;
   }
+  setLimits(ll, ul);
+}
 
+panda_ik::panda_ik(const KDL::Chain &chain, const KDL::JntArray &lower, const KDL::JntArray &upper)
+    : tracik_solver(chain, lower, upper, 2.0, 1e-5, TRAC_IK::Speed), chain(chain)
+{
+  setLimits(lower, upper);
+}
+
+void panda_ik::setLimits(const KDL::JntArray &ll, const KDL::JntArray &ul)
+{
   assert(chain.getNrOfJoints() == ll.data.size());
   assert(chain.getNrOfJoints() == ul.data.size());
 
@@ -152,11 +266,19 @@ panda_ik::panda_ik() : tracik_solver(chain_start, chain_end, "/single_robot_desc
   ub_ = ul.data;
   length = (ub_ - lb_) / 2.;
 
-  KDL::JntArray nominal(chain.getNrOfJoints());
-  for (uint j = 0; j < nominal.data.size(); j++)
-  {
-    nominal(j) = (ll(j) + ul(j)) / 2.0;
-  }
+  if (lb_.size() == 7)
+    analytic_solver.setJointLimits(lb_, ub_);
+}
+
+void panda_ik::setJointLimits(const Vector7d &lower, const Vector7d &upper)
+{
+  analytic_solver.setJointLimits(lower, upper);
+}
+
+void panda_ik::getLimits(KDL::JntArray &lower, KDL::JntArray &upper) const
+{
+  lower.data = lb_;
+  upper.data = ub_;
 }
 
 Eigen::VectorXd panda_ik::getRandomConfig()
@@ -164,8 +286,42 @@ Eigen::VectorXd panda_ik::getRandomConfig()
   return length.asDiagonal() * Eigen::VectorXd::Random(7) + length + lb_;
 }
 
+bool panda_ik::analyticSolve(const VectorXd &start, const Affine3d &target, Eigen::Ref<Eigen::VectorXd> solution)
+{
+  // sweep q7 from a random phase, the first q7 with in-limit solutions gives them
+  const unsigned int steps = 16;
+  const double q7_lower = analytic_solver.getLowerLimits()[6], q7_range = analytic_solver.getUpperLimits()[6] - q7_lower;
+  const double phase = double(std::rand()) / RAND_MAX;
+
+  analytic_solutions.clear();
+  for (unsigned int i = 0; i < steps && analytic_solutions.empty(); i++)
+    analytic_solver.solve(target, q7_lower + q7_range * std::fmod(phase + double(i) / steps, 1.), analytic_solutions);
+  if (analytic_solutions.empty())
+    return false;
+
+  int closest = 0;
+  for (unsigned int i = 1; i < analytic_solutions.size(); i++)
+    if ((analytic_solutions[i] - start).squaredNorm() < (analytic_solutions[closest] - start).squaredNorm())
+      closest = i;
+  solution = analytic_solutions[closest];
+  return true;
+}
+
+unsigned int panda_ik::solveAll(const Affine3d &target, unsigned int steps, std::vector<Vector7d> &solutions) const
+{
+  return analytic_solver.solveSweep(target, steps, solutions);
+}
+
 bool panda_ik::solve(VectorXd start, Affine3d target, Eigen::Ref<Eigen::VectorXd> solution)
 {
+  auto solve_start = std::chrono::steady_clock::now();
+  if (use_analytic_ && analyticSolve(start, target, solution))
+  {
+    recordSolve(solve_start);
+    return true;
+  }
+
+  // TRAC-IK fallback
   KDL::JntArray nominal(chain.getNrOfJoints());
   for (uint j = 0; j < nominal.data.size(); j++)
     nominal(j) = start[j];
@@ -188,7 +344,10 @@ bool panda_ik::solve(VectorXd start, Affine3d target, Eigen::Ref<Eigen::VectorXd
   A.data[8] = Rot_d(2, 2);
   end_effector_pose.M = A;
 
-  if (tracik_solver.CartToJnt(nominal, end_effector_pose, result) >= 0)
+  bool solved = tracik_solver.CartToJnt(nominal, end_effector_pose, result) >= 0;
+  recordSolve(solve_start);
+
+  if (solved)
   {
     solution = result.data;
     // std::cout << "solve" << std::endl;
@@ -197,7 +356,68 @@ bool panda_ik::solve(VectorXd start, Affine3d target, Eigen::Ref<Eigen::VectorXd
   return false;
 }
 
+void panda_ik::recordSolve(std::chrono::steady_clock::time_point start)
+{
+  auto elapsed = std::chrono::steady_clock::now() - start;
+  last_solve_time_ = std::chrono::duration<double>(elapsed).count();
+  total_solve_time_ += last_solve_time_;
+  solve_count_++;
+  if (pooled_)
+  {
+    panda_ik_pool::solves_++;
+    panda_ik_pool::solve_nanoseconds_ += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  }
+}
+
 bool panda_ik::randomSolve(Affine3d target, Eigen::Ref<Eigen::VectorXd> solution)
 {
   return solve(getRandomConfig(), target, solution);
-}
\ No newline at end of file
+}
+
+std::once_flag panda_ik_pool::parsed_;
+std::unique_ptr<panda_ik> panda_ik_pool::prototype_;
+std::mutex panda_ik_pool::limits_mutex_;
+Vector7d panda_ik_pool::lower_;
+Vector7d panda_ik_pool::upper_;
+std::atomic<unsigned int> panda_ik_pool::limits_version_{0};
+std::atomic<unsigned long> panda_ik_pool::solves_{0};
+std::atomic<unsigned long> panda_ik_pool::solve_nanoseconds_{0};
+
+panda_ik &panda_ik_pool::get()
+{
+  thread_local std::unique_ptr<panda_ik> solver;
+  if (!solver)
+  {
+    std::call_once(parsed_, [] {
+      prototype_.reset(new panda_ik());
+    });
+
+    KDL::JntArray lower, upper;
+    prototype_->getLimits(lower, upper);
+    solver.reset(new panda_ik(prototype_->getChain(), lower, upper));
+    solver->pooled_ = true;
+  }
+
+  thread_local unsigned int version = 0;
+  if (version != limits_version_)
+  {
+    std::lock_guard<std::mutex> lock(limits_mutex_);
+    solver->setJointLimits(lower_, upper_);
+    version = limits_version_;
+  }
+  return *solver;
+}
+
+void panda_ik_pool::setJointLimits(const Vector7d &lower, const Vector7d &upper)
+{
+  std::lock_guard<std::mutex> lock(limits_mutex_);
+  lower_ = lower;
+  upper_ = upper;
+  limits_version_++;
+}
+
+void panda_ik_pool::resetStats()
+{
+  solves_ = 0;
+  solve_nanoseconds_ = 0;
+}
@@ -0,0 +1,643 @@
+#include <constraint_planner/kinematics/panda_sphere_broadphase.h>
+
+#include <geometric_shapes/shape_operations.h>
+#include <ompl/util/Console.h>
+
+#include <algorithm>
+#include <cmath>
+#include <limits>
+#include <map>
+#include <memory>
+#include <numeric>
+#include <set>
+
+namespace
+{
+  // MoveIt hands out Affine3d or Isometry3d depending on the release
+  template <typename Transform>
+  Eigen::Isometry3d toIsometry(const Transform &transform)
+  {
+    Eigen::Isometry3d isometry;
+    isometry.matrix() = transform.matrix();
+    return isometry;
+  }
+
+  unsigned int steps(double length, double spacing)
+  {
+    return std::max(1u, (unsigned int)std::ceil(length / spacing));
+  }
+}
+
+panda_sphere_broadphase::panda_sphere_broadphase(const planning_scene::PlanningScene &scene, const std::string &group,
+                                                 double spacing, double max_radius, unsigned int max_spheres)
+  : spacing_(spacing), max_radius_(max_radius), max_spheres_(std::max(1u, max_spheres)), centers_(3, 0), witnesses_(3, 0)
+{
+  const robot_model::RobotModelConstPtr &model = scene.getRobotModel();
+  const robot_model::JointModelGroup *jmg = model->getJointModelGroup(group);
+  if (jmg == nullptr)
+  {
+    OMPL_WARN("Sphere broadphase : no group %s, exact checks only", group.c_str());
+    return;
+  }
+
+  robot_state::RobotState state = scene.getCurrentState();
+  state.update();
+
+  /* group joints, each one a frame placed by its parent frame */
+  for (const robot_model::JointModel *joint : jmg->getActiveJointModels())
+  {
+    if (joint->getType() != robot_model::JointModel::REVOLUTE)
+    {
+      OMPL_WARN("Sphere broadphase : %s is not revolute, exact checks only", joint->getName().c_str());
+      return;
+    }
+    joints_.push_back(joint);
+  }
+
+  for (unsigned int i = 0; i < joints_.size(); i++)
+  {
+    const robot_model::JointModel *joint = joints_[i];
+    Frame frame;
+    frame.parent = frameOf(joint->getParentLinkModel());
+    if (frame.parent >= (int)i)
+    {
+      OMPL_WARN("Sphere broadphase : group joints are not in chain order, exact checks only");
+      return;
+    }
+    frame.variable = jmg->getVariableGroupIndex(joint->getName());
+    Eigen::Isometry3d parent_pose = Eigen::Isometry3d::Identity();
+    if (frame.parent >= 0)
+      parent_pose = toIsometry(state.getGlobalLinkTransform(joints_[frame.parent]->getChildLinkModel()));
+    frame.offset = parent_pose.inverse() * toIsometry(state.getGlobalLinkTransform(joint->getParentLinkModel())) *
+                   toIsometry(joint->getChildLinkModel()->getJointOriginTransform());
+    frame.axis = static_cast<const robot_model::RevoluteJointModel *>(joint)->getAxis();
+    frames_.push_back(frame);
+  }
+
+  // the closed-form product must reproduce MoveIt's link transforms
+  robot_state::RobotState random = state;
+  random.setToRandomPositions(jmg);
+  random.update();
+  double error = 0;
+  EigenSTL::vector_Isometry3d poses;
+  for (const robot_state::RobotState *check : {&state, &random})
+  {
+    std::vector<double> q;
+    check->copyJointGroupPositions(jmg, q);
+    forwardKinematics(q.data(), poses);
+    for (unsigned int i = 0; i < joints_.size(); i++)
+    {
+      Eigen::Isometry3d pose = toIsometry(check->getGlobalLinkTransform(joints_[i]->getChildLinkModel()));
+      error = std::max(error, (poses[i].matrix() - pose.matrix()).cwiseAbs().maxCoeff());
+    }
+  }
+  if (error > 1e-6)
+  {
+    OMPL_WARN("Sphere broadphase : joint transforms differ from MoveIt by %g, exact checks only", error);
+    return;
+  }
+
+  /* bodies : links, attached objects, world objects */
+  std::vector<double> q;
+  state.copyJointGroupPositions(jmg, q);
+  forwardKinematics(q.data(), poses);
+  auto toFrame = [&](const robot_model::LinkModel *link, int frame) {
+    Eigen::Isometry3d link_pose = toIsometry(state.getGlobalLinkTransform(link));
+    return frame < 0 ? link_pose : Eigen::Isometry3d(poses[frame].inverse() * link_pose);
+  };
+
+  collision_detection::CollisionRobotConstPtr crobot = scene.getCollisionRobot();
+  bool covered = true;
+  for (const robot_model::LinkModel *link : model->getLinkModelsWithCollisionGeometry())
+  {
+    const int frame = frameOf(link);
+    const Eigen::Isometry3d link_to_frame = toFrame(link, frame);
+    EigenSTL::vector_Isometry3d shape_poses;
+    for (const auto &origin : link->getCollisionOriginTransforms())
+      shape_poses.push_back(link_to_frame * toIsometry(origin));
+    covered &= addBody(link->getName(), frame, crobot->getLinkScale(link->getName()),
+                       crobot->getLinkPadding(link->getName()), link->getShapes(), shape_poses);
+  }
+
+  std::map<std::string, std::set<std::string>> touch_links;
+  std::vector<const robot_state::AttachedBody *> attached;
+  state.getAttachedBodies(attached);
+  for (const robot_state::AttachedBody *body : attached)
+  {
+    const robot_model::LinkModel *link = body->getAttachedLink();
+    const int frame = frameOf(link);
+    const Eigen::Isometry3d link_to_frame = toFrame(link, frame);
+    EigenSTL::vector_Isometry3d shape_poses;
+    for (const auto &fixed : body->getFixedTransforms())
+      shape_poses.push_back(link_to_frame * toIsometry(fixed));
+    // the collision environment pads an attached object like the link it hangs from
+    covered &= addBody(body->getName(), frame, crobot->getLinkScale(link->getName()),
+                       crobot->getLinkPadding(link->getName()), body->getShapes(), shape_poses);
+    touch_links[body->getName()] = body->getTouchLinks();
+    touch_links[body->getName()].insert(link->getName());
+  }
+
+  for (const std::string &id : scene.getWorld()->getObjectIds())
+  {
+    collision_detection::World::ObjectConstPtr object = scene.getWorld()->getObject(id);
+    EigenSTL::vector_Isometry3d shape_poses;
+    for (const auto &pose : object->shape_poses_)
+      shape_poses.push_back(toIsometry(pose));
+    covered &= addBody(id, -1, 1.0, 0.0, object->shapes_, shape_poses);
+  }
+
+  if (!covered)
+  {
+    OMPL_WARN("Sphere broadphase : a body has a shape spheres cannot cover, exact checks only");
+    return;
+  }
+
+  /* the pairs the exact check looks at */
+  const collision_detection::AllowedCollisionMatrix &acm = scene.getAllowedCollisionMatrix();
+  auto allowance = [&](const std::string &a, const std::string &b) {
+    for (const auto &touch : {std::make_pair(a, b), std::make_pair(b, a)})
+    {
+      auto it = touch_links.find(touch.first);
+      if (it != touch_links.end() && it->second.count(touch.second))
+        return collision_detection::AllowedCollision::ALWAYS;
+    }
+    // the entry of the pair, or the default entries of its bodies
+    collision_detection::AllowedCollision::Type type;
+    if (acm.getAllowedCollision(a, b, type))
+      return type;
+    return collision_detection::AllowedCollision::NEVER;
+  };
+
+  std::vector<std::pair<std::string, std::string>> constant_pairs;
+  for (unsigned int m = 0; m < bodies_.size(); m++)
+  {
+    if (bodies_[m].frame < 0)
+      continue;
+    for (unsigned int o = 0; o < bodies_.size(); o++)
+    {
+      if (o == m || (bodies_[o].frame >= 0 && o < m))
+        continue;
+      const collision_detection::AllowedCollision::Type type = allowance(bodies_[m].name, bodies_[o].name);
+      if (type == collision_detection::AllowedCollision::ALWAYS)
+        continue;
+      if (bodies_[o].frame < 0)
+        obstacle_pairs_.push_back({m, o, type == collision_detection::AllowedCollision::NEVER});
+      else if (bodies_[o].frame != bodies_[m].frame)
+        moving_pairs_.push_back({m, o, false});
+      else
+        constant_pairs.emplace_back(bodies_[m].name, bodies_[o].name);
+    }
+  }
+
+  // two bodies on one frame never move relative to each other, the exact check at the current state settles them
+  if (!constant_pairs.empty())
+  {
+    collision_detection::CollisionRequest req;
+    collision_detection::CollisionResult res;
+    req.group_name = group;
+    req.contacts = true;
+    req.max_contacts = 1000;
+    req.max_contacts_per_pair = 1;
+    scene.checkCollision(req, res, state);
+    for (const auto &pair : constant_pairs)
+    {
+      if (res.contacts.count(pair) || res.contacts.count(std::make_pair(pair.second, pair.first)))
+        constant_collision_ = true;
+    }
+  }
+
+  ready_ = true;
+  OMPL_DEBUG("Sphere broadphase : %zu bodies, %zu spheres, %zu boxes, %zu pairs", bodies_.size(), radii_.size(),
+             boxes_.size(), getPairCount());
+}
+
+bool panda_sphere_broadphase::addBody(const std::string &name, int frame, double scale, double padding,
+                                      const std::vector<shapes::ShapeConstPtr> &shapes,
+                                      const EigenSTL::vector_Isometry3d &poses)
+{
+  Body body;
+  body.name = name;
+  body.frame = frame;
+  body_boxes_.emplace_back();
+
+  std::vector<Eigen::Vector3d> points, samples, bound;
+  bool covered = true;
+  for (std::size_t k = 0; k < shapes.size(); k++)
+  {
+    shapes::ShapeConstPtr shape = shapes[k];
+    if (scale != 1.0 || padding != 0.0)
+    {
+      shapes::ShapePtr padded(shape->clone());
+      padded->scaleAndPadd(scale, padding);
+      shape = padded;
+    }
+
+    if (frame < 0 && shape->type == shapes::BOX)
+    {
+      // obstacle boxes are tested exactly
+      const double *size = static_cast<const shapes::Box &>(*shape).size;
+      Box box;
+      box.body = bodies_.size();
+      box.rotation = poses[k].linear();
+      box.center = poses[k].translation();
+      box.half = 0.5 * Eigen::Vector3d(size[0], size[1], size[2]);
+      for (unsigned int corner = 0; corner < 8; corner++)
+      {
+        Eigen::Vector3d sign(corner & 1 ? 1 : -1, corner & 2 ? 1 : -1, corner & 4 ? 1 : -1);
+        bound.push_back(poses[k] * Eigen::Vector3d(sign.cwiseProduct(box.half)));
+      }
+      body_boxes_.back().push_back(boxes_.size());
+      boxes_.push_back(box);
+      continue;
+    }
+
+    samples.clear();
+    sampleShape(*shape, spacing_, samples);
+    if (samples.empty())
+      covered = false;
+    for (const Eigen::Vector3d &sample : samples)
+      points.push_back(poses[k] * sample);
+  }
+
+  Eigen::Matrix3Xd centers, witnesses;
+  Eigen::VectorXd radii;
+  fitSpheres(points, spacing_, max_radius_, max_spheres_, centers, radii, witnesses);
+
+  body.begin = radii_.size();
+  body.end = body.begin + radii.size();
+  centers_.conservativeResize(3, body.end);
+  centers_.rightCols(radii.size()) = centers;
+  radii_.conservativeResize(body.end);
+  radii_.tail(radii.size()) = radii;
+
+  body.witness_begin = witnesses_.cols();
+  body.witness_end = body.witness_begin + witnesses.cols();
+  witnesses_.conservativeResize(3, body.witness_end);
+  witnesses_.rightCols(witnesses.cols()) = witnesses;
+
+  bound.insert(bound.end(), points.begin(), points.end());
+  Eigen::Vector3d lower = Eigen::Vector3d::Constant(std::numeric_limits<double>::infinity()), upper = -lower;
+  for (const Eigen::Vector3d &point : bound)
+  {
+    lower = lower.cwiseMin(point);
+    upper = upper.cwiseMax(point);
+  }
+  body.bound_center = bound.empty() ? Eigen::Vector3d::Zero() : Eigen::Vector3d(0.5 * (lower + upper));
+  body.bound_radius = 0;
+  for (const Eigen::Vector3d &point : bound)
+    body.bound_radius = std::max(body.bound_radius, (point - body.bound_center).norm());
+  body.bound_radius += spacing_;
+
+  bodies_.push_back(body);
+  return covered;
+}
+
+int panda_sphere_broadphase::frameOf(const robot_model::LinkModel *link) const
+{
+  // the nearest group joint above the link, passive joints in between keep their current value
+  for (; link != nullptr; link = link->getParentJointModel()->getParentLinkModel())
+  {
+    auto joint = std::find(joints_.begin(), joints_.end(), link->getParentJointModel());
+    if (joint != joints_.end())
+      return joint - joints_.begin();
+  }
+  return -1;
+}
+
+void panda_sphere_broadphase::forwardKinematics(const double *q, EigenSTL::vector_Isometry3d &poses) const
+{
+  poses.resize(frames_.size());
+  for (unsigned int i = 0; i < frames_.size(); i++)
+  {
+    const Frame &frame = frames_[i];
+    Eigen::Isometry3d pose = frame.parent < 0 ? frame.offset : poses[frame.parent] * frame.offset;
+    pose.linear() = pose.linear() * Eigen::AngleAxisd(q[frame.variable], frame.axis).toRotationMatrix();
+    poses[i] = pose;
+  }
+}
+
+BROADPHASE_RESULT panda_sphere_broadphase::classify(const double *q) const
+{
+  if (!ready_)
+  {
+    uncertain_++;
+    return BROADPHASE_UNCERTAIN;
+  }
+  if (constant_collision_)
+  {
+    colliding_++;
+    return BROADPHASE_COLLIDING;
+  }
+
+  thread_local EigenSTL::vector_Isometry3d poses;
+  thread_local Eigen::Matrix3Xd centers, witnesses, bounds, local;
+  forwardKinematics(q, poses);
+
+  // moving bodies into the world, obstacles stay where they are
+  centers.resize(3, centers_.cols());
+  witnesses.resize(3, witnesses_.cols());
+  bounds.resize(3, bodies_.size());
+  for (unsigned int b = 0; b < bodies_.size(); b++)
+  {
+    const Body &body = bodies_[b];
+    const unsigned int n = body.end - body.begin, w = body.witness_end - body.witness_begin;
+    if (body.frame < 0)
+    {
+      centers.middleCols(body.begin, n) = centers_.middleCols(body.begin, n);
+      bounds.col(b) = body.bound_center;
+      continue;
+    }
+    const Eigen::Isometry3d &pose = poses[body.frame];
+    centers.middleCols(body.begin, n).noalias() = pose.linear() * centers_.middleCols(body.begin, n);
+    centers.middleCols(body.begin, n).colwise() += pose.translation();
+    witnesses.middleCols(body.witness_begin, w).noalias() = pose.linear() * witnesses_.middleCols(body.witness_begin, w);
+    witnesses.middleCols(body.witness_begin, w).colwise() += pose.translation();
+    bounds.col(b) = pose * body.bound_center;
+  }
+
+  auto boundsApart = [&](unsigned int a, unsigned int b) {
+    const double reach = bodies_[a].bound_radius + bodies_[b].bound_radius + margin_;
+    return (bounds.col(a) - bounds.col(b)).squaredNorm() > reach * reach;
+  };
+
+  // a surface point deep inside an obstacle box
+  for (const Pair &pair : obstacle_pairs_)
+  {
+    if (!pair.witness || boundsApart(pair.moving, pair.other))
+      continue;
+    const Body &body = bodies_[pair.moving];
+    const unsigned int w = body.witness_end - body.witness_begin;
+    for (unsigned int index : body_boxes_[pair.other])
+    {
+      const Box &box = boxes_[index];
+      local.noalias() = box.rotation.transpose() * (witnesses.middleCols(body.witness_begin, w).colwise() - box.center);
+      if (((local.array().abs().colwise() - (box.half.array() - margin_)).colwise().maxCoeff() < 0).any())
+      {
+        colliding_++;
+        return BROADPHASE_COLLIDING;
+      }
+    }
+  }
+
+  // every checked pair apart
+  for (const Pair &pair : obstacle_pairs_)
+  {
+    if (boundsApart(pair.moving, pair.other))
+      continue;
+    bool apart = spheresApart(pair.moving, centers, pair.other, centers, bounds.col(pair.other));
+    for (unsigned int index : body_boxes_[pair.other])
+      apart = apart && spheresApart(pair.moving, centers, boxes_[index]);
+    if (!apart)
+    {
+      uncertain_++;
+      return BROADPHASE_UNCERTAIN;
+    }
+  }
+  for (const Pair &pair : moving_pairs_)
+  {
+    if (!boundsApart(pair.moving, pair.other) &&
+        !spheresApart(pair.moving, centers, pair.other, centers, bounds.col(pair.other)))
+    {
+      uncertain_++;
+      return BROADPHASE_UNCERTAIN;
+    }
+  }
+
+  free_++;
+  return BROADPHASE_FREE;
+}
+
+bool panda_sphere_broadphase::spheresApart(unsigned int a, const Eigen::Matrix3Xd &ca, unsigned int b,
+                                           const Eigen::Matrix3Xd &cb, const Eigen::Vector3d &bound_b) const
+{
+  const Body &body_a = bodies_[a], &body_b = bodies_[b];
+  const unsigned int n = body_b.end - body_b.begin;
+  if (n == 0)
+    return true;
+  for (unsigned int i = body_a.begin; i < body_a.end; i++)
+  {
+    const double bound = body_b.bound_radius + radii_[i] + margin_;
+    if ((ca.col(i) - bound_b).squaredNorm() > bound * bound)
+      continue;
+    // one sphere of a against all of b's at once
+    auto reach = radii_.segment(body_b.begin, n).array() + (radii_[i] + margin_);
+    auto distance = (cb.middleCols(body_b.begin, n).colwise() - ca.col(i)).colwise().squaredNorm().array();
+    if ((distance < reach.square().transpose()).any())
+      return false;
+  }
+  return true;
+}
+
+bool panda_sphere_broadphase::spheresApart(unsigned int a, const Eigen::Matrix3Xd &ca, const Box &box) const
+{
+  thread_local Eigen::Matrix3Xd local;
+  const Body &body = bodies_[a];
+  const unsigned int n = body.end - body.begin;
+  if (n == 0)
+    return true;
+  // distance from a center to the box is the norm of its excess over the half sizes in the box frame
+  local.noalias() = box.rotation.transpose() * (ca.middleCols(body.begin, n).colwise() - box.center);
+  auto excess = (local.array().abs().colwise() - box.half.array()).max(0.);
+  auto reach = radii_.segment(body.begin, n).array() + margin_;
+  return !(excess.square().colwise().sum() < reach.square().transpose()).any();
+}
+
+bool panda_sphere_broadphase::getJointReach(std::vector<double> &reach) const
+{
+  reach.assign(frames_.size(), 0.);
+  if (!ready_)
+    return false;
+
+  // the axis of frame i goes through its origin, rotations keep lengths : a point c of frame f is no further from
+  // it than |c| plus the offsets of the frames between i and f
+  for (const Body &body : bodies_)
+  {
+    double length = body.bound_center.norm() + body.bound_radius;
+    for (int f = body.frame; f >= 0; f = frames_[f].parent)
+    {
+      reach[frames_[f].variable] = std::max(reach[frames_[f].variable], length);
+      length += frames_[f].offset.translation().norm();
+    }
+  }
+  return true;
+}
+
+BroadphaseStats panda_sphere_broadphase::getStats() const
+{
+  return {free_, colliding_, uncertain_};
+}
+
+void panda_sphere_broadphase::resetStats()
+{
+  free_ = colliding_ = uncertain_ = 0;
+}
+
+void panda_sphere_broadphase::fitSpheres(const std::vector<Eigen::Vector3d> &points, double gap, double max_radius,
+                                         unsigned int max_spheres, Eigen::Matrix3Xd &centers, Eigen::VectorXd &radii,
+                                         Eigen::Matrix3Xd &witnesses)
+{
+  struct Leaf
+  {
+    std::size_t begin, end;
+    Eigen::Vector3d lower, upper, center;
+    double radius;
+  };
+
+  std::vector<std::size_t> order(points.size());
+  std::iota(order.begin(), order.end(), 0);
+  auto makeLeaf = [&](std::size_t begin, std::size_t end) {
+    Leaf leaf;
+    leaf.begin = begin;
+    leaf.end = end;
+    leaf.lower = leaf.upper = points[order[begin]];
+    for (std::size_t i = begin; i < end; i++)
+    {
+      leaf.lower = leaf.lower.cwiseMin(points[order[i]]);
+      leaf.upper = leaf.upper.cwiseMax(points[order[i]]);
+    }
+    leaf.center = 0.5 * (leaf.lower + leaf.upper);
+    leaf.radius = 0;
+    for (std::size_t i = begin; i < end; i++)
+      leaf.radius = std::max(leaf.radius, (points[order[i]] - leaf.center).norm());
+    return leaf;
+  };
+
+  std::vector<Leaf> leaves;
+  if (!points.empty())
+    leaves.push_back(makeLeaf(0, points.size()));
+  while (leaves.size() < max_spheres)
+  {
+    auto largest = std::max_element(leaves.begin(), leaves.end(),
+                                     [](const Leaf &a, const Leaf &b) { return a.radius < b.radius; });
+    if (largest == leaves.end() || largest->radius + gap <= max_radius || largest->end - largest->begin < 2)
+      break;
+
+    Leaf leaf = *largest;
+    unsigned int axis;
+    (leaf.upper - leaf.lower).maxCoeff(&axis);
+    const std::size_t middle = (leaf.begin + leaf.end) / 2;
+    std::nth_element(order.begin() + leaf.begin, order.begin() + middle, order.begin() + leaf.end,
+                     [&](std::size_t a, std::size_t b) { return points[a][axis] < points[b][axis]; });
+    *largest = makeLeaf(leaf.begin, middle);
+    leaves.push_back(makeLeaf(middle, leaf.end));
+  }
+
+  centers.resize(3, leaves.size());
+  radii.resize(leaves.size());
+  std::vector<std::size_t> extremes;
+  for (std::size_t l = 0; l < leaves.size(); l++)
+  {
+    const Leaf &leaf = leaves[l];
+    centers.col(l) = leaf.center;
+    radii[l] = leaf.radius + gap;
+
+    std::set<std::size_t> leaf_extremes;
+    for (unsigned int axis = 0; axis < 3; axis++)
+    {
+      auto compare = [&](std::size_t a, std::size_t b) { return points[a][axis] < points[b][axis]; };
+      auto range = std::minmax_element(order.begin() + leaf.begin, order.begin() + leaf.end, compare);
+      leaf_extremes.insert(*range.first);
+      leaf_extremes.insert(*range.second);
+    }
+    extremes.insert(extremes.end(), leaf_extremes.begin(), leaf_extremes.end());
+  }
+  witnesses.resize(3, extremes.size());
+  for (std::size_t i = 0; i < extremes.size(); i++)
+    witnesses.col(i) = points[extremes[i]];
+}
+
+void panda_sphere_broadphase::sampleShape(const shapes::Shape &shape, double spacing, std::vector<Eigen::Vector3d> &points)
+{
+  switch (shape.type)
+  {
+  case shapes::MESH:
+  {
+    // vertices, and a barycentric grid on the triangles longer than the spacing
+    const shapes::Mesh &mesh = static_cast<const shapes::Mesh &>(shape);
+    auto vertex = [&](unsigned int v) {
+      return Eigen::Vector3d(mesh.vertices[3 * v], mesh.vertices[3 * v + 1], mesh.vertices[3 * v + 2]);
+    };
+    for (unsigned int v = 0; v < mesh.vertex_count; v++)
+      points.push_back(vertex(v));
+    for (unsigned int t = 0; t < mesh.triangle_count; t++)
+    {
+      const Eigen::Vector3d a = vertex(mesh.triangles[3 * t]), b = vertex(mesh.triangles[3 * t + 1]),
+                            c = vertex(mesh.triangles[3 * t + 2]);
+      const unsigned int n = steps(std::max({(b - a).norm(), (c - b).norm(), (a - c).norm()}), spacing);
+      for (unsigned int i = 0; i <= n; i++)
+        for (unsigned int j = 0; i + j <= n; j++)
+          if (n > 1 && i + j != 0 && i != n && j != n) // not a vertex
+            points.push_back(a + (b - a) * (double(i) / n) + (c - a) * (double(j) / n));
+    }
+    break;
+  }
+  case shapes::BOX:
+  {
+    const double *size = static_cast<const shapes::Box &>(shape).size;
+    for (unsigned int axis = 0; axis < 3; axis++)
+    {
+      const unsigned int u = (axis + 1) % 3, v = (axis + 2) % 3;
+      const unsigned int nu = steps(size[u], spacing), nv = steps(size[v], spacing);
+      for (double side : {-0.5, 0.5})
+        for (unsigned int i = 0; i <= nu; i++)
+          for (unsigned int j = 0; j <= nv; j++)
+          {
+            Eigen::Vector3d point;
+            point[axis] = side * size[axis];
+            point[u] = (double(i) / nu - 0.5) * size[u];
+            point[v] = (double(j) / nv - 0.5) * size[v];
+            points.push_back(point);
+          }
+    }
+    break;
+  }
+  case shapes::CYLINDER:
+  case shapes::CONE:
+  {
+    // rings along z, the cone's radius shrinks from its base at -length / 2 to its apex
+    double radius, length;
+    if (shape.type == shapes::CYLINDER)
+    {
+      radius = static_cast<const shapes::Cylinder &>(shape).radius;
+      length = static_cast<const shapes::Cylinder &>(shape).length;
+    }
+    else
+    {
+      radius = static_cast<const shapes::Cone &>(shape).radius;
+      length = static_cast<const shapes::Cone &>(shape).length;
+    }
+    const bool cone = shape.type == shapes::CONE;
+    const unsigned int nz = steps(std::hypot(length, cone ? radius : 0.), spacing);
+    const unsigned int nr = steps(radius, spacing);
+    const unsigned int na = std::max(8u, steps(2 * M_PI * radius, spacing));
+    for (unsigned int k = 0; k <= nz; k++)
+    {
+      const double z = (double(k) / nz - 0.5) * length;
+      const double r = cone ? radius * (0.5 - z / length) : radius;
+      for (unsigned int a = 0; a < na; a++)
+        points.emplace_back(r * std::cos(2 * M_PI * a / na), r * std::sin(2 * M_PI * a / na), z);
+    }
+    for (double z : cone ? std::vector<double>{-0.5 * length} : std::vector<double>{-0.5 * length, 0.5 * length})
+      for (unsigned int i = 0; i < nr; i++)
+        for (unsigned int a = 0; a < na; a++)
+          points.emplace_back(radius * i / nr * std::cos(2 * M_PI * a / na), radius * i / nr * std::sin(2 * M_PI * a / na), z);
+    break;
+  }
+  case shapes::SPHERE:
+  {
+    const double radius = static_cast<const shapes::Sphere &>(shape).radius;
+    const unsigned int nt = steps(M_PI * radius, spacing), na = std::max(8u, steps(2 * M_PI * radius, spacing));
+    for (unsigned int t = 0; t <= nt; t++)
+      for (unsigned int a = 0; a < na; a++)
+      {
+        const double theta = M_PI * t / nt, phi = 2 * M_PI * a / na;
+        points.emplace_back(radius * std::sin(theta) * std::cos(phi), radius * std::sin(theta) * std::sin(phi),
+                            radius * std::cos(theta));
+      }
+    break;
+  }
+  default:
+    // planes and octrees have no finite cover, the caller gives up
+    break;
+  }
+}
@@ -0,0 +1,139 @@
+#include <constraint_planner/kinematics/parallel_ik.h>
+
+#include <limits>
+
+parallel_ik::parallel_ik(unsigned int threads)
+{
+  if (threads == 0)
+    threads = std::max(1u, std::thread::hardware_concurrency());
+
+  for (unsigned int i = 0; i < threads; i++)
+    workers_.emplace_back(&parallel_ik::work, this);
+}
+
+parallel_ik::~parallel_ik()
+{
+  {
+    std::lock_guard<std::mutex> lock(pool_mutex_);
+    shutdown_ = true;
+  }
+  work_cv_.notify_all();
+  for (auto &worker : workers_)
+    worker.join();
+}
+
+parallel_ik &parallel_ik::get()
+{
+  static parallel_ik instance;
+  return instance;
+}
+
+bool parallel_ik::solve(const Affine3d &target_serve, const Affine3d &target_main, unsigned int seeds,
+                        const ValidityCheckerFn &is_valid, Eigen::Ref<Eigen::VectorXd> solution,
+                        SCORE score, const Eigen::VectorXd &start)
+{
+  assert(score != START_DISTANCE || start.size() == 14);
+  std::lock_guard<std::mutex> solve_lock(solve_mutex_);
+
+  Batch batch;
+  batch.target_serve = target_serve;
+  batch.target_main = target_main;
+  batch.seeds = seeds;
+  batch.is_valid = &is_valid;
+  batch.score = score;
+  batch.start = start;
+
+  {
+    std::unique_lock<std::mutex> lock(pool_mutex_);
+    batch_ = &batch;
+    generation_++;
+    busy_ = workers_.size();
+    work_cv_.notify_all();
+    done_cv_.wait(lock, [this] { return busy_ == 0; });
+    batch_ = nullptr;
+  }
+
+  seeds_run_ = batch.run;
+  seeds_cancelled_ = seeds - batch.run;
+  if (!batch.found)
+    return false;
+
+  solution = batch.best;
+  return true;
+}
+
+void parallel_ik::work()
+{
+  unsigned long seen = 0;
+  while (true)
+  {
+    Batch *batch;
+    {
+      std::unique_lock<std::mutex> lock(pool_mutex_);
+      work_cv_.wait(lock, [&] { return shutdown_ || generation_ != seen; });
+      if (shutdown_)
+        return;
+      seen = generation_;
+      batch = batch_;
+    }
+
+    while (!batch->cancelled && batch->next_seed++ < batch->seeds)
+      runSeed(*batch);
+
+    {
+      std::lock_guard<std::mutex> lock(pool_mutex_);
+      if (--busy_ == 0)
+        done_cv_.notify_one();
+    }
+  }
+}
+
+void parallel_ik::runSeed(Batch &batch)
+{
+  panda_ik &solver = panda_ik_pool::get();
+  Eigen::VectorXd q(14);
+  batch.run++;
+
+  if (!solver.randomSolve(batch.target_serve, q.segment<7>(0)) || batch.cancelled)
+    return;
+  if (!solver.randomSolve(batch.target_main, q.segment<7>(7)) || batch.cancelled)
+    return;
+  if (!(*batch.is_valid)(q))
+    return;
+
+  if (batch.score == FIRST_ACCEPTED)
+  {
+    std::lock_guard<std::mutex> lock(batch.best_mutex);
+    if (!batch.found)
+    {
+      batch.found = true;
+      batch.best = q;
+    }
+    batch.cancelled = true;
+    return;
+  }
+
+  // ranked : every seed runs, nothing cancels the batch
+  double score = scorePair(batch, q);
+  std::lock_guard<std::mutex> lock(batch.best_mutex);
+  if (!batch.found || score > batch.best_score)
+  {
+    batch.found = true;
+    batch.best_score = score;
+    batch.best = q;
+  }
+}
+
+double parallel_ik::scorePair(const Batch &batch, const Eigen::VectorXd &q) const
+{
+  if (batch.score == START_DISTANCE)
+    return -(q - batch.start).norm();
+
+  double manipulability = std::numeric_limits<double>::infinity();
+  for (int arm = 0; arm < 2; arm++)
+  {
+    Matrix<double, 6, 7> jacobian = panda_arm_.getJacobian(q.segment<7>(arm * 7));
+    manipulability = std::min(manipulability, std::sqrt(std::max(0., (jacobian * jacobian.transpose()).determinant())));
+  }
+  return manipulability;
+}
@@ -99,10 +99,13 @@ bool plannedPath()
     auto ss = std::make_shared<KinematicChainSpace>(links);
     std::vector<enum PLANNER_TYPE> planners = {RRT, PRM, newRRT, newPRM, RRTConnect, newRRTConnect}; //RRTConnect
     
-    auto constraint = std::make_shared<KinematicChainConstraint>(links);
+    enum SPACE_TYPE space = PJ; // AT, TB build an atlas instead of projecting every sample
+    // charts need a full rank jacobian and the true manifold dimension, only the log map residual has both
+    ChainConstraintPtr constraint = makeChainConstraint(links, space == PJ ? ANGLE_RESIDUAL : LOG_MAP_RESIDUAL);
 
-    ConstrainedProblem cp(ss, constraint); // define a simple problem to solve this constrained space
+    ConstrainedProblem cp(space, ss, constraint); // define a simple problem to solve this constrained space
     cp.setConstrainedOptions();
+    cp.setAtlasOptions();
     cp.ss->setStateValidityChecker(std::make_shared<KinematicChainValidityChecker>(cp.csi));
     cp.setStartAndGoalStates();
 
@@ -1,98 +1,104 @@
-
 #include <constraint_planner/planner/NoRandomSampleSpace.h>
 
-#include <Eigen/Core>
+#include <ompl/util/Exception.h>
+#include <ompl/util/RandomNumbers.h>
+
+#include <algorithm>
+#include <numeric>
 #include <utility>
 
-/// NoRandomSampler
+/// HaltonSequence
 
 /// Public
 
-ompl::base::NoRandomSampler::NoRandomSampler(const NoRandomSampleSpace *space, StateSamplerPtr sampler)
-  : WrapperStateSampler(space, std::move(sampler)), constraint_(space->getConstraint())
+ompl::base::HaltonSequence::HaltonSequence(unsigned int dimension)
 {
-}
+    for (unsigned int candidate = 2; bases_.size() < dimension; candidate++)
+    {
+        bool prime = true;
+        for (unsigned int base : bases_)
+        {
+            if (candidate % base == 0)
+            {
+                prime = false;
+                break;
+            }
+        }
+        if (prime)
+            bases_.push_back(candidate);
+    }
 
-void ompl::base::NoRandomSampler::sampleUniform(State *state)
-{
-    WrapperStateSampler::sampleUniform(state);
-    constraint_->project(state);
-    space_->enforceBounds(state);
+    // digit 0 stays 0, otherwise every index would carry an infinite tail of permuted zeros
+    RNG rng;
+    for (unsigned int base : bases_)
+    {
+        std::vector<unsigned int> permutation(base);
+        std::iota(permutation.begin(), permutation.end(), 0);
+        for (unsigned int i = base - 1; i > 1; i--)
+            std::swap(permutation[i], permutation[rng.uniformInt(1, i)]);
+        permutations_.push_back(std::move(permutation));
+    }
 }
 
-void ompl::base::NoRandomSampler::sampleUniformNear(State *state, const State *near, const double distance)
+std::uint64_t ompl::base::HaltonSequence::claimBlock(unsigned int size)
 {
-    WrapperStateSampler::sampleUniformNear(state, near, distance);
-    constraint_->project(state);
-    space_->enforceBounds(state);
+    return next_.fetch_add(size, std::memory_order_relaxed);
 }
 
-void ompl::base::NoRandomSampler::sampleGaussian(State *state, const State *mean, const double stdDev)
+void ompl::base::HaltonSequence::point(std::uint64_t index, double *out) const
 {
-    WrapperStateSampler::sampleGaussian(state, mean, stdDev);
-    constraint_->project(state);
-    space_->enforceBounds(state);
+    for (unsigned int d = 0; d < bases_.size(); d++)
+    {
+        const unsigned int base = bases_[d];
+        const std::vector<unsigned int> &permutation = permutations_[d];
+        const double inverse = 1.0 / base;
+
+        double scale = inverse, value = 0;
+        for (std::uint64_t i = index; i > 0; i /= base)
+        {
+            value += permutation[i % base] * scale;
+            scale *= inverse;
+        }
+        out[d] = value;
+    }
 }
 
-/// NoRandomSampleSpace
+/// NoRandomSampler
 
 /// Public
 
-bool ompl::base::NoRandomSampleSpace::discreteGeodesic(const State *from, const State *to, bool interpolate,
-                                                       std::vector<State *> *geodesic) const
+ompl::base::NoRandomSampler::NoRandomSampler(const StateSpace *space, HaltonSequencePtr sequence, unsigned int blockSize)
+  : StateSampler(space)
+  , sequence_(std::move(sequence))
+  , random_(space->allocDefaultStateSampler())
+  , blockSize_(std::max(1u, blockSize))
+  , point_(space->getDimension())
 {
-    // Save a copy of the from state.
-    if (geodesic != nullptr)
-    {
-        geodesic->clear();
-        geodesic->push_back(cloneState(from));
-    }
-
-    const double tolerance = delta_;
-
-    // No need to traverse the manifold if we are already there.
-    double dist, step, total = 0;
-    if ((dist = distance(from, to)) <= tolerance)
-        return true;
-
-    const double max = dist * lambda_;
-
-    auto previous = cloneState(from);
-    auto scratch = allocState();
-
-    auto &&svc = si_->getStateValidityChecker();
+    if (sequence_->getDimension() != space->getDimension())
+        throw Exception("NoRandomSampler: the sequence and the space have different dimensions.");
+}
 
-    do
+void ompl::base::NoRandomSampler::sampleUniform(State *state)
+{
+    if (next_ == end_)
     {
-        WrapperStateSpace::interpolate(previous, to, delta_ / dist, scratch);
-
-        // Project new state onto constraint manifold
-        if (!constraint_->project(scratch)                  // not on manifold
-            || !(interpolate || svc->isValid(scratch))      // not valid
-            || (step = distance(previous, scratch)) > lambda_ * delta_)  // deviated
-            break;
-
-        // Check if we have wandered too far
-        total += step;
-        if (total > max)
-            break;
-
-        // Check if we are no closer than before
-        const double newDist = distance(scratch, to);
-        if (newDist >= dist)
-            break;
-
-        dist = newDist;
-        copyState(previous, scratch);
-
-        // Store the new state
-        if (geodesic != nullptr)
-            geodesic->push_back(cloneState(scratch));
+        next_ = sequence_->claimBlock(blockSize_);
+        end_ = next_ + blockSize_;
+    }
+    sequence_->point(next_++, point_.data());
 
-    } while (dist >= tolerance);
+    const RealVectorBounds &bounds = space_->as<RealVectorStateSpace>()->getBounds();
+    double *values = state->as<RealVectorStateSpace::StateType>()->values;
+    for (unsigned int i = 0; i < point_.size(); i++)
+        values[i] = bounds.low[i] + point_[i] * (bounds.high[i] - bounds.low[i]);
+}
 
-    freeState(scratch);
-    freeState(previous);
+void ompl::base::NoRandomSampler::sampleUniformNear(State *state, const State *near, const double distance)
+{
+    random_->sampleUniformNear(state, near, distance);
+}
 
-    return dist <= tolerance;
+void ompl::base::NoRandomSampler::sampleGaussian(State *state, const State *mean, const double stdDev)
+{
+    random_->sampleGaussian(state, mean, stdDev);
 }
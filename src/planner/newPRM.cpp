@@ -9,6 +9,7 @@
 #include <boost/graph/incremental_components.hpp>
 #include <boost/property_map/vector_property_map.hpp>
 #include <boost/foreach.hpp>
+#include <limits>
 #include <thread>
 
 #include "GoalVisitor.hpp"
@@ -41,10 +42,12 @@ ompl::geometric::newPRM::newPRM(const base::SpaceInformationPtr &si, bool starSt
     specs_.optimizingPaths = true;
     specs_.multithreaded = true;
     panda_arm = std::make_shared<FrankaModelUpdater>();
-    panda_ik_solver = std::make_shared<panda_ik>();
     if (!starStrategy_)
         Planner::declareParam<unsigned int>("max_nearest_neighbors", this, &newPRM::setMaxNearestNeighbors,
                                             std::string("8:1000"));
+    Planner::declareParam<unsigned int>("ik_seeds", this, &newPRM::setIKSeeds, &newPRM::getIKSeeds, "1:256");
+    Planner::declareParam<double>("bounce_distance", this, &newPRM::setBounceDistance, &newPRM::getBounceDistance,
+                                  "0.:0.1:10.");
 
     addPlannerProgressProperty("iterations INTEGER", [this] {
         return getIterationCount();
@@ -58,6 +61,17 @@ ompl::geometric::newPRM::newPRM(const base::SpaceInformationPtr &si, bool starSt
     addPlannerProgressProperty("edge count INTEGER", [this] {
         return getEdgeCountString();
     });
+    for (int i = 0; i < SAMPLER_STAGES; i++)
+    {
+        SAMPLER_STAGE stage = static_cast<SAMPLER_STAGE>(i);
+        std::string name = std::string("sampler ") + jy_ConstrainedValidStateSampler::getStageName(stage);
+        addPlannerProgressProperty(name + " acceptance REAL", [this, stage] {
+            return getSamplerStageString(stage, false);
+        });
+        addPlannerProgressProperty(name + " time REAL", [this, stage] {
+            return getSamplerStageString(stage, true);
+        });
+    }
 }
 
 ompl::geometric::newPRM::~newPRM()
@@ -73,10 +87,15 @@ void ompl::geometric::newPRM::setup()
         specs_.multithreaded = false; // temporarily set to false since nn_ is used only in single thread
         nn_.reset(tools::SelfConfig::getDefaultNearestNeighbors<Vertex>(this));
         specs_.multithreaded = true;
-        nn_->setDistanceFunction([this](const Vertex a, const Vertex b) {
-            return distanceFunction(a, b);
-        });
     }
+    // also for a structure from setNearestNeighbors(), which comes without one
+    nn_->setDistanceFunction([this](const Vertex a, const Vertex b) {
+        return distanceFunction(a, b);
+    });
+    if (auto &&soa = std::dynamic_pointer_cast<jy_NearestNeighborsSoA<Vertex>>(nn_))
+        soa->setCoordinateFunction([this](const Vertex &v) {
+            return jy_soa::stateCoordinates(stateProperty_[v]);
+        });
     if (!connectionStrategy_)
     {
         if (starStrategy_)
@@ -207,7 +226,8 @@ void ompl::geometric::newPRM::expandRoadmap(const base::PlannerTerminationCondit
     {
         iterations_++;
         Vertex v = pdf.sample(rng_.uniform01());
-        unsigned int s =
+        unsigned int s = bounceDistance_ > 0 ?
+            localBounceMotion(stateProperty_[v], workStates) :
             si_->randomBounceMotion(simpleSampler_, stateProperty_[v], workStates.size(), workStates, false);
         if (s > 0)
         {
@@ -256,6 +276,21 @@ void ompl::geometric::newPRM::expandRoadmap(const base::PlannerTerminationCondit
     }
 }
 
+unsigned int ompl::geometric::newPRM::localBounceMotion(const base::State *start, std::vector<base::State *> &states) const
+{
+    const base::State *prev = start;
+    std::pair<base::State *, double> lastValid;
+    unsigned int j = 0;
+    for (unsigned int i = 0; i < states.size(); ++i)
+    {
+        simpleSampler_->sampleUniformNear(states[j], prev, bounceDistance_);
+        lastValid.first = states[j];
+        if (si_->checkMotion(prev, states[j], lastValid) || lastValid.second > std::numeric_limits<double>::epsilon())
+            prev = states[j++];
+    }
+    return j;
+}
+
 void ompl::geometric::newPRM::growRoadmap(double growTime)
 {
     growRoadmap(base::timedPlannerTerminationCondition(growTime));
@@ -338,6 +373,15 @@ bool ompl::geometric::newPRM::sampleIKgoal(ob::State *state)
 {
     Eigen::Map<Eigen::VectorXd> &sol = *state->as<ob::ConstrainedStateSpace::StateType>();
 
+    // called from the IK workers, each checks its own copy of the state
+    parallel_ik::ValidityCheckerFn is_valid = [this](const Eigen::VectorXd &q) {
+        ob::State *candidate = si_->allocState();
+        candidate->as<ob::ConstrainedStateSpace::StateType>()->copy(q);
+        bool valid = si_->isValid(candidate);
+        si_->freeState(candidate);
+        return valid;
+    };
+
     int stefan_tries = 500;
     while (--stefan_tries)
     {
@@ -351,22 +395,8 @@ bool ompl::geometric::newPRM::sampleIKgoal(ob::State *state)
         Affine3d target_left = grp.base_serve.inverse() * base_obj * grp.obj_Sgrasp;
         Affine3d target_right = grp.base_main.inverse() * base_obj * grp.obj_Mgrasp;
 
-        int tries = 50;
-        while (--tries)
-        {
-            bool left, right;
-            left = panda_ik_solver->randomSolve(target_left, sol.segment<7>(0));
-            right = panda_ik_solver->randomSolve(target_right, sol.segment<7>(7));
-            if (left && right)
-            {
-                if (si_->isValid(state))
-                {
-                    return true;
-                }
-            }
-            else
-                break;
-        }
+        if (parallel_ik::get().solve(target_left, target_right, ikSeeds_, is_valid, sol))
+            return true;
     }
     return false;
 }
@@ -43,6 +43,8 @@ void ompl::geometric::newRRT::setup()
     if (!nn_)
         nn_.reset(tools::SelfConfig::getDefaultNearestNeighbors<Motion *>(this));
     nn_->setDistanceFunction([this](const Motion *a, const Motion *b) { return distanceFunction(a, b); });
+    if (auto &&soa = std::dynamic_pointer_cast<jy_NearestNeighborsSoA<Motion *>>(nn_))
+        soa->setCoordinateFunction([](Motion *const &m) { return jy_soa::stateCoordinates(m->state); });
 }
 
 void ompl::geometric::newRRT::freeMemory()
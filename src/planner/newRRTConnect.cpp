@@ -39,6 +39,9 @@ void ompl::geometric::newRRTConnect::setup()
         tGoal_.reset(tools::SelfConfig::getDefaultNearestNeighbors<Motion *>(this));
     tStart_->setDistanceFunction([this](const Motion *a, const Motion *b) { return distanceFunction(a, b); });
     tGoal_->setDistanceFunction([this](const Motion *a, const Motion *b) { return distanceFunction(a, b); });
+    for (auto &&tree : {tStart_, tGoal_})
+        if (auto &&soa = std::dynamic_pointer_cast<jy_NearestNeighborsSoA<Motion *>>(tree))
+            soa->setCoordinateFunction([](Motion *const &m) { return jy_soa::stateCoordinates(m->state); });
 }
 
 void ompl::geometric::newRRTConnect::freeMemory()
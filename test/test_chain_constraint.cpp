@@ -0,0 +1,198 @@
+// Eigen allocates with malloc, not operator new : it checks its own allocations against set_is_malloc_allowed().
+// The target builds this file and the kinematics it runs with the check on, see CMakeLists.txt
+#if !defined(EIGEN_RUNTIME_NO_MALLOC) || defined(NDEBUG)
+#error "build with EIGEN_RUNTIME_NO_MALLOC and without NDEBUG, Eigen does not check its allocations otherwise"
+#endif
+
+#include <constraint_planner/constraints/ConstraintFunction.h>
+
+#include <gtest/gtest.h>
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+/* every other heap allocation of the process goes through here, the ones made while counting are counted */
+static std::atomic<bool> counting{false};
+static std::atomic<unsigned long> allocations{0};
+
+void *operator new(std::size_t size)
+{
+    if (counting)
+        allocations++;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+class ChainConstraintTest : public ::testing::Test
+{
+protected:
+    void SetUp() override
+    {
+        grasping_point grp;
+        start = grp.start;
+        constraint.setTolerance(0.002, 0.025);
+        constraint.setMaxIterations(200);
+        ASSERT_EQ(constraint.getArmModel().getBackend(), CLOSED_FORM_KINEMATICS);
+    }
+
+    KinematicChainConstraint constraint{14};
+    Eigen::VectorXd start;
+};
+
+/* project() and the OMPL interface run on fixed-size types only, with the closed-form kinematics backend
+   nothing in them touches the heap */
+TEST_F(ChainConstraintTest, ProjectionDoesNotAllocate)
+{
+    const int samples = 100;
+    std::srand(1);
+    Eigen::MatrixXd perturbed(14, samples);
+    for (int i = 0; i < samples; i++)
+        perturbed.col(i) = start + 0.05 * Eigen::VectorXd::Random(14);
+
+    Eigen::VectorXd x(14), f(4);
+    Eigen::MatrixXd j(4, 14);
+    for (PROJECTION_TYPE type : {NEWTON_PROJECTION, LM_PROJECTION, BOUNDED_PROJECTION})
+    {
+        constraint.setProjectionType(type);
+        x = start;
+        constraint.project(x); // the thread's first call sets up its last projection
+
+        unsigned int projected = 0;
+        allocations = 0;
+        counting = true;
+        Eigen::internal::set_is_malloc_allowed(false); // an Eigen allocation aborts the test
+        for (int i = 0; i < samples; i++)
+        {
+            x = perturbed.col(i);
+            constraint.isSatisfied(x);
+            projected += constraint.project(x);
+            constraint.isSatisfied(x); // answered from the projection
+            constraint.function(x, f);
+            constraint.jacobian(x, j);
+        }
+        counting = false;
+        Eigen::internal::set_is_malloc_allowed(true);
+
+        const unsigned long counted = allocations;
+        EXPECT_EQ(counted, 0u) << "projection type " << type;
+        EXPECT_GT(projected, 0u) << "projection type " << type;
+    }
+}
+
+/* central differences of constraint.function() at x */
+static Eigen::MatrixXd centralDifferences(const ChainConstraint &constraint, const Eigen::VectorXd &x, double h)
+{
+    const unsigned int k = constraint.getCoDimension();
+    Eigen::VectorXd xh(x), fp(k), fm(k);
+    Eigen::MatrixXd numeric(k, x.size());
+    for (int i = 0; i < x.size(); i++)
+    {
+        xh = x;
+        xh[i] += h;
+        constraint.function(xh, fp);
+        xh[i] -= 2 * h;
+        constraint.function(xh, fm);
+        numeric.col(i) = (fp - fm) / (2 * h);
+    }
+    return numeric;
+}
+
+/* the analytic jacobian against central differences of function(), with both kinematics backends. The angle
+   residual has a kink where it is 0 (on the manifold) and at pi, its row is only compared away from both */
+TEST_F(ChainConstraintTest, JacobianMatchesCentralDifferences)
+{
+    const double h = 1e-6, tolerance = 1e-6, kink = 1e-3;
+
+    Eigen::VectorXd x(14), f(4);
+    Eigen::MatrixXd j(4, 14), numeric(4, 14);
+    for (KINEMATICS_BACKEND backend : {CLOSED_FORM_KINEMATICS, RBDL_KINEMATICS})
+    {
+        constraint.getArmModel().setBackend(backend);
+        std::srand(2);
+        unsigned int compared = 0;
+        for (int sample = 0; sample <= 200; sample++)
+        {
+            // the start state is on the manifold, the others are off it
+            x = start;
+            if (sample > 0)
+                x += 0.5 * Eigen::VectorXd::Random(14);
+
+            constraint.function(x, f);
+            constraint.jacobian(x, j);
+            numeric = centralDifferences(constraint, x, h);
+
+            const int rows = (f[3] > kink && f[3] < M_PI - kink) ? 4 : 3;
+            EXPECT_LT((j.topRows(rows) - numeric.topRows(rows)).cwiseAbs().maxCoeff(), tolerance)
+                << "backend " << backend << ", sample " << sample << "\nanalytic\n" << j << "\nnumeric\n" << numeric;
+            if (rows == 4)
+                compared++;
+        }
+        EXPECT_GT(compared, 100u) << "backend " << backend; // the orientation row was checked at most off-manifold samples
+    }
+    constraint.getArmModel().setBackend(CLOSED_FORM_KINEMATICS);
+}
+
+/* the same for the 6 log map residuals. Their rows are compared away from the identity, where the axis is
+   undefined, and from a rotation of pi, where the log jumps to the opposite axis. Half the samples turn the main
+   arm's flange close to pi, where the inverse left jacobian is the least benign */
+TEST_F(ChainConstraintTest, LogJacobianMatchesCentralDifferences)
+{
+    const double h = 1e-6, tolerance = 1e-6, kink = 1e-3;
+
+    KinematicChainLogConstraint log_constraint(14);
+    Eigen::VectorXd x(14), f(6);
+    Eigen::MatrixXd j(6, 14), numeric(6, 14);
+    for (KINEMATICS_BACKEND backend : {CLOSED_FORM_KINEMATICS, RBDL_KINEMATICS})
+    {
+        log_constraint.getArmModel().setBackend(backend);
+        std::srand(6);
+        unsigned int compared = 0, near_pi = 0;
+        for (int sample = 0; sample <= 200; sample++)
+        {
+            x = start;
+            if (sample % 2)
+            {
+                // about the flange axis the orientation residual turns by the same angle
+                x[13] += (M_PI - 0.05 * (1 + Eigen::internal::random<double>(0, 1)));
+                x += 1e-2 * Eigen::VectorXd::Random(14);
+            }
+            else if (sample > 0)
+                x += 0.5 * Eigen::VectorXd::Random(14);
+
+            log_constraint.function(x, f);
+            log_constraint.jacobian(x, j);
+            numeric = centralDifferences(log_constraint, x, h);
+
+            const double angle = f.tail<3>().norm();
+            const int rows = (angle > kink && angle < M_PI - kink) ? 6 : 3;
+            EXPECT_LT((j.topRows(rows) - numeric.topRows(rows)).cwiseAbs().maxCoeff(), tolerance)
+                << "backend " << backend << ", sample " << sample << ", angle " << angle << "\nanalytic\n" << j
+                << "\nnumeric\n" << numeric;
+            if (rows == 6)
+            {
+                compared++;
+                near_pi += angle > M_PI - 0.2;
+            }
+        }
+        EXPECT_GT(compared, 150u) << "backend " << backend;
+        EXPECT_GT(near_pi, 75u) << "backend " << backend; // most of the flange turns stayed on this side of pi
+    }
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}
@@ -0,0 +1,40 @@
+#include <constraint_planner/kinematics/panda_model_updater.h>
+
+#include <gtest/gtest.h>
+
+#include <cstdlib>
+
+/* the closed-form kinematics must reproduce the RBDL model they replace, on random joint vectors */
+TEST(FrankaModelUpdaterTest, ForwardKinematicsMatchesRBDL)
+{
+    FrankaModelUpdater panda_arm;
+    std::srand(3);
+    for (int sample = 0; sample < 1000; sample++)
+    {
+        Vector7d q = M_PI * Vector7d::Random();
+        EXPECT_LT(panda_arm.checkForwardKinematics(q), 1e-9) << "q " << q.transpose();
+    }
+}
+
+/* getTransformAndJacobian() of the closed-form backend against getTransform() and getJacobian() of RBDL */
+TEST(FrankaModelUpdaterTest, JacobianMatchesRBDL)
+{
+    FrankaModelUpdater panda_arm(CLOSED_FORM_KINEMATICS), rbdl_arm(RBDL_KINEMATICS);
+    std::srand(4);
+    for (int sample = 0; sample < 1000; sample++)
+    {
+        Vector7d q = M_PI * Vector7d::Random();
+        Affine3d transform;
+        Matrix<double, 6, 7> jacobian;
+        panda_arm.getTransformAndJacobian(q, transform, jacobian);
+
+        EXPECT_LT((transform.matrix() - rbdl_arm.getTransform(q).matrix()).cwiseAbs().maxCoeff(), 1e-9) << "q " << q.transpose();
+        EXPECT_LT((jacobian - rbdl_arm.getJacobian(q)).cwiseAbs().maxCoeff(), 1e-9) << "q " << q.transpose();
+    }
+}
+
+int main(int argc, char **argv)
+{
+    testing::InitGoogleTest(&argc, argv);
+    return RUN_ALL_TESTS();
+}